@@ -6,202 +6,4499 @@
 #include <unordered_map>
 #include <vector>
 #include <algorithm>
+#include <array>
+#include <bitset>
+#include <atomic>
+#include <cassert>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <numeric>
+#include <memory_resource>
+#include <mutex>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#ifdef ARGS_PROFILE_GET
+#include <map>
+#endif
+#include <cstdint>
+#include <stdexcept>
+#include <thread>
+#include <tuple>
+#include <string_view>
+#include <type_traits>
+#include <utility>
 
+// the throwing API reports errors with ARGS_THROW. Built with -fno-exceptions
+// it prints the message and aborts instead; code that has to survive bad
+// input uses try_parse_args and try_get, which return errors as values.
+#if defined(__cpp_exceptions)
+#define ARGS_THROW(e) throw e
+#else
+#define ARGS_THROW(e) args_abort(e)
+[[noreturn]] inline void args_abort(const std::exception & e) {
+  std::fprintf(stderr, "%s\n", e.what());
+  std::abort();
+}
+#endif
+
+// a ref is just the slot of its argument in ArgsParser::mArguments, so it is
+// trivially copyable and get() is a single array access
 template <typename T>
 struct CmdlineArgRef {
-  std::string key;
-  T value;
+  std::size_t slot;
+#ifndef NDEBUG
+  std::uint64_t key_hash = 0; // hash_key of the key the ref was made for, checked by get()
+#endif
+};
+
+using AllowedArgTypes = std::variant<int, bool, float, std::string, std::string_view, std::int64_t, unsigned, std::uint64_t, double,
+                                     std::vector<int>, std::vector<float>>; // we can extent this to support more types
+
+// position of T in AllowedArgTypes, used to remember the declared type of each argument
+template <typename T, typename... Ts>
+constexpr std::size_t variant_index_of(const std::variant<Ts...> *) {
+  constexpr bool matches[] = {std::is_same_v<T, Ts>...};
+  for (std::size_t i = 0; i < sizeof...(Ts); i++) {
+    if (matches[i]) {
+      return i;
+    }
+  }
+  return sizeof...(Ts);
+}
+
+template <typename T>
+constexpr std::size_t arg_type_index = variant_index_of<T>(static_cast<const AllowedArgTypes *>(nullptr));
+
+//currently we only support "--xx" or "-x"
+std::string parseKey(const std::string & arg) {
+    if (arg.substr(0, 2) == "--") {
+      return arg.substr(2);
+    } else if(arg.substr(0, 1) == "-") {
+      return arg;
+    }
+     ARGS_THROW(std::runtime_error("parse invalid args: " + arg));
+  }
+
+// same rules as parseKey, but returns a slice of the input instead of a copy
+constexpr std::string_view parseKeyView(std::string_view arg) {
+    if (arg.substr(0, 2) == "--") {
+      return arg.substr(2);
+    } else if (arg.substr(0, 1) == "-") {
+      return arg;
+    }
+    ARGS_THROW(std::runtime_error("parse invalid args: " + std::string(arg)));
+}
+
+constexpr std::uint64_t hash_mix(std::uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdull;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ull;
+  h ^= h >> 33;
+  return h;
+}
+
+// FNV-1a followed by a finalizer so the low bits are usable as a table index
+constexpr std::uint64_t hash_key(std::string_view key) {
+  std::uint64_t h = 14695981039346656037ull;
+  for (char c : key) {
+    h ^= static_cast<unsigned char>(c);
+    h *= 1099511628211ull;
+  }
+  return hash_mix(h);
+}
+
+// where a value came from, later layers win: default < config file < environment < command line
+enum class ValueSource : std::uint8_t {
+    Default,
+    ConfigFile,
+    Environment,
+    CommandLine,
+};
+
+// a string in the schema's StringPool
+struct PooledString {
+    std::uint32_t offset = 0;
+    std::uint32_t size = 0;
+};
+
+enum ArgFlags : std::uint8_t {
+    kStoreTrue = 1,
+    kOptional = 2,
+    kHasDefault = 4, // value holds the default
+};
+
+// per-slot data that parsing and get() touch, one cache line. Key and help
+// text live in the schema's string pool.
+struct alignas(64) Argument {
+    AllowedArgTypes value;  // the default, typed, if kHasDefault
+    PooledString key;
+    PooledString description;
+    std::uint8_t type_index = 0; // index of the declared type in AllowedArgTypes
+    std::uint8_t flags = 0; // ArgFlags
+
+    bool is_store_true() const { return (flags & kStoreTrue) != 0; }
+    bool is_optional() const { return (flags & kOptional) != 0; }
+    bool has_default() const { return (flags & kHasDefault) != 0; }
+    void set_flag(ArgFlags flag, bool on) { flags = on ? flags | flag : flags & ~flag; }
+};
+static_assert(sizeof(Argument) <= 64, "Argument should fit one cache line");
+
+// a value supplied by one of the layers, a parse result only stores these
+struct ArgValue {
+    std::uint32_t slot;
+    ValueSource source;
+    bool is_store_passed; // Add a new field to indicate whether the argument is passed
+    AllowedArgTypes value;
+};
+
+std::uint64_t next_schema_id() {
+  static std::atomic<std::uint64_t> counter{0};
+  return ++counter;
+}
+
+// open addressing key -> slot table. It only stores slot numbers and compares
+// against Argument::key, so it can be probed with a std::string_view
+struct KeyIndex {
+  std::vector<std::uint32_t> buckets; // slot + 1, 0 is empty
+  std::size_t size = 0;
+};
+
+constexpr std::size_t kNoSlot = static_cast<std::size_t>(-1);
+constexpr std::size_t kAmbiguousSlot = kNoSlot - 1; // see find_abbreviated_slot
+
+// key_of(slot) gives the string a slot is indexed under
+template <typename KeyOf>
+std::size_t find_slot(const KeyIndex & index, std::string_view key, KeyOf && key_of) {
+  if (index.buckets.empty()) {
+    return kNoSlot;
+  }
+  std::size_t mask = index.buckets.size() - 1;
+  for (std::size_t b = hash_key(key) & mask;; b = (b + 1) & mask) {
+    std::uint32_t entry = index.buckets[b];
+    if (entry == 0) {
+      return kNoSlot;
+    }
+    if (key_of(entry - 1) == key) {
+      return entry - 1;
+    }
+  }
+}
+
+template <typename KeyOf>
+void insert_slot(KeyIndex & index, std::size_t slot, KeyOf && key_of) {
+  if (2 * (index.size + 1) > index.buckets.size()) {
+    KeyIndex grown;
+    grown.buckets.assign(std::max<std::size_t>(16, 2 * index.buckets.size()), 0);
+    for (std::uint32_t entry : index.buckets) {
+      if (entry != 0) {
+        insert_slot(grown, entry - 1, key_of);
+      }
+    }
+    index = std::move(grown);
+  }
+  std::size_t mask = index.buckets.size() - 1;
+  std::size_t b = hash_key(key_of(slot)) & mask;
+  while (index.buckets[b] != 0) {
+    b = (b + 1) & mask;
+  }
+  index.buckets[b] = static_cast<std::uint32_t>(slot + 1);
+  index.size++;
+}
+
+// interned strings, equal strings are stored once. Keys and descriptions of a
+// schema go here so the Argument records stay small; a generated schema
+// repeats the same help text thousands of times.
+struct StringPool {
+  std::string chars; // '\0' after every string
+  std::vector<PooledString> strings; // id -> position in chars
+  KeyIndex ids; // text -> id
+};
+
+std::string_view pool_view(const StringPool & pool, PooledString s) {
+  return std::string_view(pool.chars.data() + s.offset, s.size);
+}
+
+PooledString intern(StringPool & pool, std::string_view text) {
+  auto text_of = [&](std::size_t id) { return pool_view(pool, pool.strings[id]); };
+  std::size_t id = find_slot(pool.ids, text, text_of);
+  if (id != kNoSlot) {
+    return pool.strings[id];
+  }
+  PooledString s{static_cast<std::uint32_t>(pool.chars.size()), static_cast<std::uint32_t>(text.size())};
+  pool.chars.append(text);
+  pool.chars.push_back('\0');
+  pool.strings.push_back(s);
+  insert_slot(pool.ids, pool.strings.size() - 1, text_of);
+  return s;
+}
+
+// a private, writable mapping of a file. Tokenizing writes into it (quotes are
+// removed, tokens get a '\0'), which only copies the pages that are touched
+struct MappedFile {
+  char *data = nullptr;
+  std::size_t size = 0;
+  std::size_t mapped_size = 0;
+
+  MappedFile() = default;
+  MappedFile(const MappedFile &) = delete;
+  MappedFile & operator=(const MappedFile &) = delete;
+  ~MappedFile() {
+    if (data != nullptr) {
+      munmap(data, mapped_size);
+    }
+  }
+};
+
+// maps path and guarantees data[size] is a writable '\0', even when the file
+// ends exactly on a page boundary. nullptr if it cannot be opened or mapped.
+std::shared_ptr<MappedFile> try_map_file(const std::string & path, struct stat * st = nullptr) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat file_stat;
+  if (fd < 0 || fstat(fd, &file_stat) != 0) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    return nullptr;
+  }
+  auto file = std::make_shared<MappedFile>();
+  std::size_t page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+  file->size = static_cast<std::size_t>(file_stat.st_size);
+  file->mapped_size = (file->size + 1 + page - 1) / page * page;
+  // reserve zeroed pages for size + 1 bytes, then put the file over the front
+  void *base = mmap(nullptr, file->mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (base != MAP_FAILED && file->size > 0 &&
+      mmap(base, file->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+    munmap(base, file->mapped_size);
+    base = MAP_FAILED;
+  }
+  close(fd);
+  if (base == MAP_FAILED) {
+    return nullptr;
+  }
+  file->data = static_cast<char *>(base);
+  if (st != nullptr) {
+    *st = file_stat;
+  }
+  return file;
+}
+
+std::shared_ptr<MappedFile> map_file(const std::string & path, struct stat * st = nullptr) {
+  std::shared_ptr<MappedFile> file = try_map_file(path, st);
+  if (file == nullptr) {
+    ARGS_THROW(std::runtime_error("cannot open " + path));
+  }
+  return file;
+}
+
+// one bit per slot. Bitsets made before the schema grew are simply shorter,
+// missing words read as zero. A parse keeps its scratch bitset in the memory
+// resource of the result.
+using SlotBitset = std::pmr::vector<std::uint64_t>;
+
+void set_bit(SlotBitset & bits, std::size_t slot, bool value = true) {
+  if (bits.size() <= slot / 64) {
+    bits.resize(slot / 64 + 1);
+  }
+  std::uint64_t mask = std::uint64_t(1) << (slot % 64);
+  bits[slot / 64] = value ? bits[slot / 64] | mask : bits[slot / 64] & ~mask;
+}
+
+bool test_bit(const SlotBitset & bits, std::size_t slot) {
+  return slot / 64 < bits.size() && (bits[slot / 64] >> (slot % 64) & 1) != 0;
+}
+
+// batch-size -> PREFIX_BATCH_SIZE. Namespaced keys carry their own prefix:
+// -ll:gpus -> LL_GPUS
+std::string env_name(std::string_view prefix, std::string_view key) {
+  std::string name;
+  if (key.substr(0, 1) == "-" && key.find(':') != std::string_view::npos) {
+    key.remove_prefix(key.find_first_not_of('-'));
+  } else {
+    name = prefix;
+  }
+  for (char c : key) {
+    name += (c == '-' || c == ':') ? '_' : static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+  }
+  return name;
+}
+
+// environment variable names of the schema. Scanning environ rejects most
+// variables by comparing their first bytes against the few name prefixes in
+// use (the env prefix and LL_, LG_, ... of namespaced keys) and hashes only
+// the rest, instead of one getenv per registered key.
+struct EnvIndex {
+  std::vector<std::string> names; // per slot
+  KeyIndex slots; // name -> slot
+  std::vector<std::pair<std::uint64_t, std::uint64_t>> heads; // first <= 8 bytes of a prefix, mask
+};
+
+// the first n <= 8 bytes of s as a word, and the mask selecting them
+std::pair<std::uint64_t, std::uint64_t> head_word(std::string_view s) {
+  std::uint64_t word = 0;
+  std::size_t n = std::min<std::size_t>(s.size(), 8);
+  std::memcpy(&word, s.data(), n);
+  return {word, n == 8 ? ~std::uint64_t(0) : (std::uint64_t(1) << (8 * n)) - 1};
+}
+
+void add_env_name(EnvIndex & env, std::string_view prefix, std::size_t slot, std::string_view key) {
+  std::string name = env_name(prefix, key);
+  std::string_view head = std::string_view(name).substr(0, name.compare(0, prefix.size(), prefix) == 0 && !prefix.empty()
+                                                                ? prefix.size() : name.find('_') + 1);
+  auto word = head_word(head);
+  if (std::find(env.heads.begin(), env.heads.end(), word) == env.heads.end()) {
+    env.heads.push_back(word);
+  }
+  if (env.names.size() <= slot) {
+    env.names.resize(slot + 1);
+  }
+  env.names[slot] = std::move(name);
+  insert_slot(env.slots, slot, [&](std::size_t s) -> std::string_view { return env.names[s]; });
+}
+
+// ---------------------------------------------------------------------------
+// namespaces and abbreviations
+//
+// Runtime flags live in namespaces: -ll:gpus is key "gpus" in namespace
+// "-ll:". Every registered key is also kept in a prefix trie, so resolving a
+// key that is not registered verbatim costs one walk over its characters,
+// independent of the schema size. The walk tells whether the key is an
+// unambiguous prefix of a registered key (--batch for --batch-size) and
+// whether its namespace is known to the schema at all.
+// ---------------------------------------------------------------------------
+
+// "-ll:gpus" -> "-ll:", empty for keys outside a namespace
+std::string_view key_namespace(std::string_view key) {
+  std::size_t colon = key.find(':');
+  if (key.substr(0, 1) != "-" || colon == std::string_view::npos) {
+    return {};
+  }
+  return key.substr(0, colon + 1);
+}
+
+struct KeyTrie {
+  // 16 bytes, value initialized to all zero
+  struct Node {
+    std::uint32_t first_child; // 0 is none, the root is never a child
+    std::uint32_t next_sibling;
+    std::uint32_t slot; // slot + 1 of the key ending here, 0 if none
+    std::uint32_t keys : 24; // keys ending in this subtree
+    std::uint32_t c : 8;
+  };
+  std::vector<Node> nodes; // nodes[0] is the root, added with the first key
+};
+
+std::uint32_t trie_child(const KeyTrie & trie, std::uint32_t node, char c) {
+  for (std::uint32_t child = trie.nodes[node].first_child; child != 0; child = trie.nodes[child].next_sibling) {
+    if (trie.nodes[child].c == static_cast<unsigned char>(c)) {
+      return child;
+    }
+  }
+  return 0;
+}
+
+// node of the non-empty prefix key, 0 if no registered key starts with it
+std::uint32_t trie_find(const KeyTrie & trie, std::string_view key) {
+  if (trie.nodes.empty()) {
+    return 0;
+  }
+  std::uint32_t node = 0;
+  for (char c : key) {
+    if ((node = trie_child(trie, node, c)) == 0) {
+      return 0;
+    }
+  }
+  return node;
+}
+
+// key must not be in the trie yet
+void trie_insert(KeyTrie & trie, std::string_view key, std::size_t slot) {
+  if (trie.nodes.empty()) {
+    trie.nodes.emplace_back();
+  }
+  std::uint32_t node = 0;
+  trie.nodes[node].keys++;
+  for (char c : key) {
+    std::uint32_t child = trie_child(trie, node, c);
+    if (child == 0) {
+      child = static_cast<std::uint32_t>(trie.nodes.size());
+      trie.nodes.emplace_back();
+      trie.nodes[child].c = static_cast<unsigned char>(c);
+      trie.nodes[child].next_sibling = trie.nodes[node].first_child;
+      trie.nodes[node].first_child = child;
+    }
+    node = child;
+    trie.nodes[node].keys++;
+  }
+  trie.nodes[node].slot = static_cast<std::uint32_t>(slot + 1);
+}
+
+// slots of up to limit keys below node, for error messages
+void trie_collect(const KeyTrie & trie, std::uint32_t node, std::size_t limit, std::vector<std::size_t> & slots) {
+  if (trie.nodes[node].slot != 0 && slots.size() < limit) {
+    slots.push_back(trie.nodes[node].slot - 1);
+  }
+  for (std::uint32_t child = trie.nodes[node].first_child; child != 0 && slots.size() < limit;
+       child = trie.nodes[child].next_sibling) {
+    trie_collect(trie, child, limit, slots);
+  }
+}
+
+// gets every flag of a namespace that is not registered, value is empty for
+// a flag without one. Called from parse_args, i.e. from several threads at
+// once under parse_args_batch.
+using NamespaceHandler = std::function<void(std::string_view key, std::string_view value)>;
+
+// bigram postings of all keys, see suggest_keys
+struct SuggestIndex {
+  static constexpr std::size_t kBuckets = 4096;
+  std::vector<std::uint32_t> offsets; // bucket -> first entry in slots, kBuckets + 1 of them
+  std::vector<std::uint32_t> slots; // keys having a bigram in the bucket, each once
+};
+
+// built on the first unknown key and kept until a key is added. Only the
+// error path gets here, the mutex does not cost a parse anything.
+struct SuggestCache {
+  std::mutex mutex;
+  std::unique_ptr<const SuggestIndex> index;
+
+  SuggestCache() = default;
+  SuggestCache(const SuggestCache &) {} // the copy of a schema gets its own keys
+  SuggestCache & operator=(const SuggestCache &) {
+    index.reset();
+    return *this;
+  }
+};
+
+// a set of bytes, for pattern constraints. Built from ranges and lists of
+// characters at compile time, e.g. kAlnum | char_set("-_.").
+struct CharSet {
+  std::array<std::uint64_t, 4> bits{};
+
+  constexpr bool contains(unsigned char c) const { return (bits[c >> 6] >> (c & 63)) & 1; }
+  constexpr void add(unsigned char c) { bits[c >> 6] |= std::uint64_t(1) << (c & 63); }
+};
+
+constexpr CharSet operator|(CharSet a, const CharSet & b) {
+  for (std::size_t w = 0; w < a.bits.size(); w++) {
+    a.bits[w] |= b.bits[w];
+  }
+  return a;
+}
+
+constexpr CharSet char_set(std::string_view chars) {
+  CharSet set;
+  for (char c : chars) {
+    set.add(static_cast<unsigned char>(c));
+  }
+  return set;
+}
+
+constexpr CharSet char_range(char first, char last) {
+  CharSet set;
+  for (int c = static_cast<unsigned char>(first); c <= static_cast<unsigned char>(last); c++) {
+    set.add(static_cast<unsigned char>(c));
+  }
+  return set;
+}
+
+constexpr CharSet kDigits = char_range('0', '9');
+constexpr CharSet kLower = char_range('a', 'z');
+constexpr CharSet kUpper = char_range('A', 'Z');
+constexpr CharSet kAlpha = kLower | kUpper;
+constexpr CharSet kAlnum = kAlpha | kDigits;
+
+enum class CheckKind : std::uint8_t {
+    Range,   // numbers and every element of a list within [lo, hi]
+    Choices, // a string equal to one of ArgSchema::mChoices[first, first + count)
+    Pattern, // a string of [lo, hi] characters, all in ArgSchema::mCharSets[first]
+};
+
+// a constraint on the value of one slot, see add_range, add_choices and
+// add_pattern. The schema keeps them sorted by slot.
+struct ValueCheck {
+    std::uint32_t slot;
+    CheckKind kind;
+    std::uint32_t first = 0;
+    std::uint32_t count = 0;
+    double lo = 0;
+    double hi = 0;
+};
+
+struct ArgsParser;
+
+// a predicate over several values, see add_check
+struct CrossCheck {
+    PooledString message; // in the schema's string pool
+    std::function<bool(const ArgsParser &)> predicate;
+};
+
+// everything the add_*_argument calls register. A schema is shared by its
+// parser and every parse result made from it, and is copied only when a parser
+// whose schema is shared registers something new (copy on write).
+struct ArgSchema {
+  std::vector<Argument> mArguments; // one slot per registered key
+  StringPool mStrings; // keys and descriptions of mArguments
+  KeyIndex mSlots; // key -> index into mArguments
+  std::uint64_t schema_id = next_schema_id(); // shared by a schema and its parse results
+  SlotBitset mRequired; // must be supplied by some layer
+  std::vector<SlotBitset> mExclusiveGroups; // at most one of each group
+  std::vector<SlotBitset> mOneOfGroups; // at least one of each group
+  std::vector<std::pair<std::uint32_t, std::uint32_t>> mRequires; // first needs second
+  std::vector<ValueCheck> mValueChecks; // sorted by slot, checked in one pass over the values
+  std::vector<PooledString> mChoices; // allowed strings of the Choices checks
+  std::vector<CharSet> mCharSets; // allowed characters of the Pattern checks
+  std::vector<CrossCheck> mCrossChecks; // run once every value passed its own checks
+  std::string mConfigFile; // key = value defaults, read by parse_args if set
+  std::optional<std::string> mEnvPrefix; // read PREFIX_KEY environment variables if set
+  EnvIndex mEnv; // environment variable name -> slot, empty without a prefix
+  KeyTrie mKeyTrie; // all keys, for abbreviations and namespace lookups
+  std::vector<std::pair<std::string, NamespaceHandler>> mNamespaceHandlers; // "-ll:" -> handler
+  bool mAllowAbbrev = true; // accept unambiguous prefixes of keys on the command line
+  mutable SuggestCache mSuggest; // for "did you mean" on unknown keys
+};
+
+std::string_view arg_key(const ArgSchema & schema, std::size_t slot) {
+  return pool_view(schema.mStrings, schema.mArguments[slot].key);
+}
+
+std::string_view arg_description(const ArgSchema & schema, std::size_t slot) {
+  return pool_view(schema.mStrings, schema.mArguments[slot].description);
+}
+
+std::size_t find_slot(const ArgSchema & schema, std::string_view key) {
+  return find_slot(schema.mSlots, key, [&](std::size_t slot) { return arg_key(schema, slot); });
+}
+
+// ---------------------------------------------------------------------------
+// key suggestions
+//
+// An unknown key is answered with the nearest registered keys. Candidates
+// come from bigram postings: an edit touches at most two bigrams of the key
+// padded with start/end markers, so a key within distance d misses at most
+// 2d of the query's bigram buckets. Walking the postings shortest first, a
+// key still unseen after 2d + 1 lists is out of reach. The candidates found
+// there count how many query buckets they share, and only those sharing at
+// least |buckets| - 2d (the q-gram count filter) get an exact distance,
+// computed with Myers' bit-parallel algorithm (one 64-bit word per text
+// character). They are verified most shared buckets first, so the limit d
+// drops early and the count threshold rises with it.
+// ---------------------------------------------------------------------------
+
+// distinct bigram buckets of ^key$
+template <typename F>
+void for_each_bigram_bucket(std::string_view key, F && f) {
+  std::bitset<SuggestIndex::kBuckets> seen;
+  unsigned prev = 0x02; // start marker
+  for (std::size_t i = 0; i <= key.size(); i++) {
+    unsigned c = i < key.size() ? static_cast<unsigned char>(key[i]) : 0x03; // end marker
+    std::size_t bucket = (prev * 131 + c) % SuggestIndex::kBuckets;
+    if (!seen[bucket]) {
+      seen[bucket] = true;
+      f(bucket);
+    }
+    prev = c;
+  }
+}
+
+std::unique_ptr<const SuggestIndex> build_suggest_index(const ArgSchema & schema) {
+  auto index = std::make_unique<SuggestIndex>();
+  index->offsets.assign(SuggestIndex::kBuckets + 1, 0);
+  std::size_t n = schema.mArguments.size();
+  for (std::size_t slot = 0; slot < n; slot++) {
+    for_each_bigram_bucket(arg_key(schema, slot), [&](std::size_t bucket) { index->offsets[bucket + 1]++; });
+  }
+  for (std::size_t b = 0; b < SuggestIndex::kBuckets; b++) {
+    index->offsets[b + 1] += index->offsets[b];
+  }
+  index->slots.resize(index->offsets.back());
+  std::vector<std::uint32_t> fill(index->offsets.begin(), index->offsets.end() - 1);
+  for (std::size_t slot = 0; slot < n; slot++) {
+    for_each_bigram_bucket(arg_key(schema, slot), [&](std::size_t bucket) {
+      index->slots[fill[bucket]++] = static_cast<std::uint32_t>(slot);
+    });
+  }
+  return index;
+}
+
+// Levenshtein distance, pattern at most 64 characters. peq[c] has bit i set
+// where pattern[i] == c.
+std::size_t myers_distance(const std::array<std::uint64_t, 256> & peq, std::size_t m, std::string_view text) {
+  std::uint64_t pv = m == 64 ? ~std::uint64_t(0) : (std::uint64_t(1) << m) - 1;
+  std::uint64_t mv = 0;
+  std::uint64_t high = std::uint64_t(1) << (m - 1);
+  std::size_t score = m;
+  for (char ch : text) {
+    std::uint64_t eq = peq[static_cast<unsigned char>(ch)];
+    std::uint64_t xv = eq | mv;
+    std::uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+    std::uint64_t ph = mv | ~(xh | pv);
+    std::uint64_t mh = pv & xh;
+    if (ph & high) {
+      score++;
+    } else if (mh & high) {
+      score--;
+    }
+    ph = (ph << 1) | 1; // row 0 is 0, 1, 2, ...: the whole pattern has to match
+    mh <<= 1;
+    pv = mh | ~(xv | ph);
+    mv = ph & xv;
+  }
+  return score;
+}
+
+// the textbook dynamic program, for keys longer than a word
+std::size_t dp_distance(std::string_view a, std::string_view b) {
+  std::vector<std::size_t> row(b.size() + 1);
+  for (std::size_t j = 0; j <= b.size(); j++) {
+    row[j] = j;
+  }
+  for (std::size_t i = 1; i <= a.size(); i++) {
+    std::size_t diagonal = row[0];
+    row[0] = i;
+    for (std::size_t j = 1; j <= b.size(); j++) {
+      std::size_t up = row[j];
+      row[j] = std::min({row[j] + 1, row[j - 1] + 1, diagonal + (a[i - 1] != b[j - 1])});
+      diagonal = up;
+    }
+  }
+  return row[b.size()];
+}
+
+// up to k registered keys nearest to key, closest first. Keys further than a
+// third of the key length (at least 2 edits) are not suggested.
+std::vector<std::string_view> suggest_keys(const ArgSchema & schema, std::string_view key, std::size_t k = 3) {
+  if (key.empty() || k == 0 || schema.mArguments.empty()) {
+    return {};
+  }
+  const SuggestIndex *index;
+  {
+    std::lock_guard<std::mutex> lock(schema.mSuggest.mutex);
+    if (schema.mSuggest.index == nullptr) {
+      schema.mSuggest.index = build_suggest_index(schema);
+    }
+    index = schema.mSuggest.index.get();
+  }
+  std::size_t max_distance = std::max<std::size_t>(2, key.size() / 3);
+
+  // the query's buckets, fewest keys first
+  std::vector<std::size_t> buckets;
+  for_each_bigram_bucket(key, [&](std::size_t bucket) { buckets.push_back(bucket); });
+  auto postings = [&](std::size_t bucket) { return index->offsets[bucket + 1] - index->offsets[bucket]; };
+  std::sort(buckets.begin(), buckets.end(), [&](std::size_t a, std::size_t b) { return postings(a) < postings(b); });
+
+  std::array<std::uint64_t, 256> peq{};
+  if (key.size() <= 64) {
+    for (std::size_t i = 0; i < key.size(); i++) {
+      peq[static_cast<unsigned char>(key[i])] |= std::uint64_t(1) << i;
+    }
+  }
+  auto closer = [&](const auto & a, const auto & b) {
+    return a.first != b.first ? a.first < b.first : arg_key(schema, a.second) < arg_key(schema, b.second);
+  };
+  std::vector<std::pair<std::size_t, std::uint32_t>> found; // the k best so far, closest first
+  auto limit = [&] { return found.size() < k ? max_distance : found.back().first; };
+  auto consider = [&](std::uint32_t slot) {
+    std::string_view candidate = arg_key(schema, slot);
+    std::size_t length_gap = candidate.size() > key.size() ? candidate.size() - key.size() : key.size() - candidate.size();
+    if (length_gap > limit()) {
+      return;
+    }
+    std::size_t distance = key.size() <= 64 ? myers_distance(peq, key.size(), candidate) : dp_distance(key, candidate);
+    std::pair<std::size_t, std::uint32_t> entry{distance, slot};
+    if (distance <= limit() && (found.size() < k || closer(entry, found.back()))) {
+      found.insert(std::upper_bound(found.begin(), found.end(), entry, closer), entry);
+      found.resize(std::min(found.size(), k));
+    }
+  };
+  std::vector<bool> checked(schema.mArguments.size());
+  auto check = [&](std::uint32_t slot) {
+    if (!checked[slot]) {
+      checked[slot] = true;
+      consider(slot);
+    }
+  };
+  auto list = [&](std::size_t i) {
+    return std::make_pair(index->slots.data() + index->offsets[buckets[i]],
+                          index->slots.data() + index->offsets[buckets[i] + 1]);
+  };
+  // the keys of the rarest lists until k are found: they bring the limit
+  // down before the filter below is sized by it
+  std::size_t q = buckets.size();
+  for (std::size_t i = 0; i < q && found.size() < k; i++) {
+    for (auto [e, last] = list(i); e != last; e++) {
+      check(*e);
+    }
+  }
+  // lists holding every key (a prefix all generated keys share) count for
+  // everyone and are not walked; they sort last
+  std::size_t everyone = 0;
+  while (everyone < q && postings(buckets[q - 1 - everyone]) == schema.mArguments.size()) {
+    everyone++;
+  }
+  if (q <= 2 * limit() + everyone) {
+    // even a key sharing none of the other buckets might be close
+    for (std::size_t slot = 0; slot < checked.size(); slot++) {
+      check(static_cast<std::uint32_t>(slot));
+    }
+  } else {
+    // a key within the limit shares at least need of the q buckets left, so
+    // it is in one of their first q - need + 1 lists, and after list i it can
+    // still gain at most q - i - 1. Candidates that cannot make it any more
+    // are dropped, and long lists are searched for the few left instead of
+    // walked.
+    q -= everyone;
+    std::size_t need = q - 2 * limit();
+    std::vector<std::uint16_t> counts(schema.mArguments.size());
+    std::vector<std::uint32_t> candidates;
+    for (std::size_t i = 0; i < q; i++) {
+      auto [first, last] = list(i);
+      if (i > q - need) {
+        std::size_t left = q - i;
+        candidates.erase(std::remove_if(candidates.begin(), candidates.end(),
+                                        [&](std::uint32_t slot) { return counts[slot] + left < need; }),
+                         candidates.end());
+      }
+      if (i > q - need && candidates.size() * 16 < static_cast<std::size_t>(last - first)) {
+        for (std::uint32_t slot : candidates) {
+          counts[slot] += std::binary_search(first, last, slot); // postings are sorted by slot
+        }
+        continue;
+      }
+      for (const std::uint32_t *e = first; e != last; e++) {
+        if (counts[*e]++ == 0 && i <= q - need) {
+          candidates.push_back(*e);
+        }
+      }
+    }
+    // most shared buckets first, so the limit drops early and the threshold
+    // rises with it (a counting sort, a count is at most q)
+    std::vector<std::uint32_t> starts(q + 2);
+    for (std::uint32_t slot : candidates) {
+      starts[q - counts[slot] + 1]++;
+    }
+    std::partial_sum(starts.begin(), starts.end(), starts.begin());
+    std::vector<std::uint32_t> ordered(candidates.size());
+    for (std::uint32_t slot : candidates) {
+      ordered[starts[q - counts[slot]]++] = slot;
+    }
+    for (std::uint32_t slot : ordered) {
+      if (counts[slot] + 2 * limit() < q) {
+        break; // the rest share even fewer buckets
+      }
+      check(slot);
+    }
+  }
+  std::size_t keep = found.size();
+  std::vector<std::string_view> keys;
+  for (std::size_t i = 0; i < keep; i++) {
+    keys.push_back(arg_key(schema, found[i].second));
+  }
+  return keys;
+}
+
+// "invalid args: x does not exist", with the nearest keys if there are any
+std::string unknown_key_message(const ArgSchema & schema, std::string_view key) {
+  std::string message = "invalid args: " + std::string(key) + " does not exist";
+  std::vector<std::string_view> keys = suggest_keys(schema, key);
+  for (std::size_t i = 0; i < keys.size(); i++) {
+    message += i == 0 ? ", did you mean " : " or ";
+    message += keys[i].substr(0, 1) == "-" ? std::string(keys[i]) : "--" + std::string(keys[i]);
+  }
+  return message + (keys.empty() ? "" : "?");
+}
+
+// a schema being built, or a parse result: the shared schema plus only the
+// values that were supplied, sorted by slot. Anything else falls through to
+// the schema default.
+//
+// The containers of a parse result come from the memory resource given to
+// parse_args (the default resource otherwise), so results parsed into one
+// arena are released with it. Such a result must not outlive its resource.
+// Copies use the default resource again.
+struct ArgsParser {
+  ArgsParser() = default;
+  // an empty result of schema, allocating from resource
+  ArgsParser(std::shared_ptr<const ArgSchema> schema, std::pmr::memory_resource *resource)
+      : mSchema(std::move(schema)), mValues(resource), mMappedFiles(resource), mPassThrough(resource) {}
+
+  // created non-const, see mutable_schema
+  std::shared_ptr<const ArgSchema> mSchema = std::make_shared<ArgSchema>();
+  std::pmr::vector<ArgValue> mValues;
+  std::pmr::vector<std::shared_ptr<MappedFile>> mMappedFiles; // response/config files the values point into
+  std::pmr::vector<const char *> mPassThrough; // argv entries of namespaces this schema does not know, in order
+};
+
+// an argv without its own storage, e.g. the arguments parse_known_args left
+struct ArgvView {
+  int argc;
+  const char **argv;
 };
 
-using AllowedArgTypes = std::variant<int, bool, float, std::string>; // we can extent this to support more types
+// the schema of parser for registering, unshared first if a parse result or
+// another parser still refers to it. Every schema is created as a non-const
+// ArgSchema and only handed out as const, so the const_cast is well defined.
+ArgSchema & mutable_schema(ArgsParser & parser) {
+  if (parser.mSchema.use_count() > 1) {
+    parser.mSchema = std::make_shared<ArgSchema>(*parser.mSchema);
+  }
+  return const_cast<ArgSchema &>(*parser.mSchema);
+}
+
+// "ll", "ll:" or "-ll:" all name the namespace of -ll:gpus
+std::string namespace_key(std::string_view ns) {
+  std::string key = ns.substr(0, 1) == "-" ? std::string(ns) : "-" + std::string(ns);
+  return key.back() == ':' ? key : key + ":";
+}
+
+// every flag of ns that is not registered goes to handler instead of failing
+void add_namespace_handler(ArgsParser & parser, std::string_view ns, NamespaceHandler handler) {
+  mutable_schema(parser).mNamespaceHandlers.emplace_back(namespace_key(ns), std::move(handler));
+}
+
+void set_allow_abbrev(ArgsParser & parser, bool allow) {
+  mutable_schema(parser).mAllowAbbrev = allow;
+}
+
+const NamespaceHandler *find_namespace_handler(const ArgSchema & schema, std::string_view ns) {
+  for (const auto & [name, handler] : schema.mNamespaceHandlers) {
+    if (name == ns) {
+      return &handler;
+    }
+  }
+  return nullptr;
+}
+
+// the slot key abbreviates, kNoSlot if it is no prefix of a registered key
+// and kAmbiguousSlot if it is a prefix of several
+std::size_t find_abbreviated_slot(const ArgSchema & schema, std::string_view key) {
+  std::uint32_t node = key.empty() || !schema.mAllowAbbrev ? 0 : trie_find(schema.mKeyTrie, key);
+  if (node == 0) {
+    return kNoSlot;
+  }
+  if (schema.mKeyTrie.nodes[node].keys > 1) {
+    return kAmbiguousSlot;
+  }
+  // a single key below node, follow the only path down to it
+  while (schema.mKeyTrie.nodes[node].slot == 0) {
+    node = schema.mKeyTrie.nodes[node].first_child;
+  }
+  return schema.mKeyTrie.nodes[node].slot - 1;
+}
+
+// "invalid args: x is ambiguous, could be ...", up to 8 candidates
+std::string ambiguous_key_message(const ArgSchema & schema, std::string_view key) {
+  std::vector<std::size_t> slots;
+  trie_collect(schema.mKeyTrie, trie_find(schema.mKeyTrie, key), 8, slots);
+  std::string candidates;
+  for (std::size_t slot : slots) {
+    candidates += (candidates.empty() ? "" : ", ") + std::string(arg_key(schema, slot));
+  }
+  return "invalid args: " + std::string(key) + " is ambiguous, could be " + candidates;
+}
+
+void set_config_file(ArgsParser & parser, const std::string & path) {
+  mutable_schema(parser).mConfigFile = path;
+}
+
+void set_env_prefix(ArgsParser & parser, const std::string & prefix) {
+  ArgSchema & schema = mutable_schema(parser);
+  schema.mEnvPrefix = prefix;
+  schema.mEnv = EnvIndex{};
+  for (std::size_t slot = 0; slot < schema.mArguments.size(); slot++) {
+    add_env_name(schema.mEnv, prefix, slot, arg_key(schema, slot));
+  }
+}
+
+// calls f(slot, value) for every environment variable that names a registered
+// key, in one pass over environ. value points into the environment block.
+template <typename F>
+void for_each_env_entry(const ArgSchema & schema, F && f) {
+  if (!schema.mEnvPrefix.has_value() || schema.mEnv.heads.empty()) {
+    return;
+  }
+  const EnvIndex & env = schema.mEnv;
+  for (char **entry = environ; *entry != nullptr; entry++) {
+    const char *var = *entry;
+    std::uint64_t word = 0;
+    std::size_t n = strnlen(var, 8);
+    std::memcpy(&word, var, n);
+    bool candidate = false;
+    for (const auto & [head, mask] : env.heads) {
+      candidate |= (word & mask) == head; // a shorter variable has '\0's where the head has bytes
+    }
+    if (!candidate) {
+      continue;
+    }
+    const char *eq = std::strchr(var, '=');
+    if (eq == nullptr) {
+      continue;
+    }
+    std::size_t slot = find_slot(env.slots, std::string_view(var, eq - var),
+                                 [&](std::size_t s) -> std::string_view { return env.names[s]; });
+    if (slot != kNoSlot) {
+      f(slot, eq + 1);
+    }
+  }
+}
+
+// slot of key, appending a new one if the key is not registered yet
+std::size_t find_or_add_slot(ArgSchema & schema, const std::string & key) {
+  std::size_t slot = find_slot(schema, key);
+  if (slot == kNoSlot) {
+    slot = schema.mArguments.size();
+    schema.mArguments.emplace_back();
+    schema.mArguments.back().key = intern(schema.mStrings, key);
+    schema.mSuggest.index.reset();
+    insert_slot(schema.mSlots, slot, [&](std::size_t s) { return arg_key(schema, s); });
+    trie_insert(schema.mKeyTrie, key, slot);
+    if (schema.mEnvPrefix.has_value()) {
+      add_env_name(schema.mEnv, *schema.mEnvPrefix, slot, key);
+    }
+  }
+  return slot;
+}
+
+// the value supplied for slot, nullptr if it falls through to the default
+const ArgValue *find_value(const ArgsParser & parser, std::size_t slot) {
+  auto it = std::lower_bound(parser.mValues.begin(), parser.mValues.end(), slot,
+                             [](const ArgValue & v, std::size_t s) { return v.slot < s; });
+  return it != parser.mValues.end() && it->slot == slot ? &*it : nullptr;
+}
+
+template <typename T>
+CmdlineArgRef<T> make_ref(const ArgsParser & parser, std::size_t slot) {
+  CmdlineArgRef<T> ref{slot};
+#ifndef NDEBUG
+  // a copied parser keeps its ids, so the key itself is what identifies the slot
+  ref.key_hash = hash_key(arg_key(*parser.mSchema, slot));
+#else
+  (void)parser;
+#endif
+  return ref;
+}
+
+//default_value is std::nullopt 
+// template <typename T>
+//   CmdlineArgRef<T> add_required_argument(ArgsParser & parser, const std::string & key, const std::optional<T> & default_value,
+//                          const std::string &description, bool is_store_true = false) {
+//     std::string parse_key = parseKey(key);
+//     parser.requeiredArguments[parse_key].description = description;
+//     if(default_value.has_value()) {  // Use has_value() to check if there's a value
+//         parser.requeiredArguments[parse_key].value = std::to_string(default_value.value());  // Convert the value to string
+//         parser.requeiredArguments[parse_key].default_value = true;
+//         parser.requeiredArguments[parse_key].is_store_true = is_store_true;
+//         return CmdlineArgRef<T>{parse_key, default_value.value()};
+//     } 
+//     return CmdlineArgRef<T>{parse_key, T{}};
+//   }
+
+
+// template <typename T>
+//   CmdlineArgRef<T> add_optional_argument(ArgsParser & parser, const std::string & key, const std::optional<T> & default_value,
+//                          const std::string &description, bool is_store_true = false) {
+//     std::string parse_key = parseKey(key);
+//     parser.optionalArguments[parse_key].description = description;
+//     parser.optionalArguments[parse_key].is_store_true = is_store_true;
+//     parser.num_optional_args++;
+//     return CmdlineArgRef<T>{parse_key, T{}};
+//   }
+
+//default_value is std::nullopt 
+template <typename T>
+  CmdlineArgRef<T> add_required_argument(ArgsParser & parser, const std::string & key, const std::optional<T> & default_value,
+                         const std::string &description, bool is_store_true = false) {
+    static_assert(arg_type_index<T> < std::variant_size_v<AllowedArgTypes>, "unsupported argument type");
+    ArgSchema & schema = mutable_schema(parser);
+    std::size_t slot = find_or_add_slot(schema, parseKey(key));
+    PooledString pooled_description = intern(schema.mStrings, description);
+    Argument & arg = schema.mArguments[slot];
+    arg.description = pooled_description;
+    arg.type_index = arg_type_index<T>;
+    arg.set_flag(kStoreTrue, is_store_true);
+    set_bit(schema.mRequired, slot);
+    arg.set_flag(kOptional, false);
+    return make_ref<T>(parser, slot);
+  }
+
+// at most one of the flags may be supplied
+template <typename... T>
+void add_mutually_exclusive(ArgsParser & parser, const CmdlineArgRef<T> &... refs) {
+    SlotBitset group;
+    (set_bit(group, refs.slot), ...);
+    mutable_schema(parser).mExclusiveGroups.push_back(std::move(group));
+}
+
+// at least one of the flags has to be supplied
+template <typename... T>
+void add_one_of(ArgsParser & parser, const CmdlineArgRef<T> &... refs) {
+    SlotBitset group;
+    (set_bit(group, refs.slot), ...);
+    mutable_schema(parser).mOneOfGroups.push_back(std::move(group));
+}
+
+// if a is supplied, b has to be supplied too
+template <typename A, typename B>
+void add_requires(ArgsParser & parser, const CmdlineArgRef<A> & a, const CmdlineArgRef<B> & b) {
+    mutable_schema(parser).mRequires.emplace_back(static_cast<std::uint32_t>(a.slot), static_cast<std::uint32_t>(b.slot));
+}
+
+
+template <typename T>
+  CmdlineArgRef<T> add_optional_argument(ArgsParser & parser, const std::string & key, const std::optional<T> & default_value,
+                         const std::string &description, bool is_store_true = false) {
+    static_assert(arg_type_index<T> < std::variant_size_v<AllowedArgTypes>, "unsupported argument type");
+    ArgSchema & schema = mutable_schema(parser);
+    std::size_t slot = find_or_add_slot(schema, parseKey(key));
+    PooledString pooled_description = intern(schema.mStrings, description);
+    Argument & arg = schema.mArguments[slot];
+    set_bit(schema.mRequired, slot, false);
+    arg.description = pooled_description;
+    arg.type_index = arg_type_index<T>;
+    arg.set_flag(kStoreTrue, is_store_true);
+    arg.set_flag(kOptional, true);
+    if(default_value.has_value()) {  // Use has_value() to check if there's a value
+        arg.value = AllowedArgTypes{default_value.value()};
+        arg.set_flag(kHasDefault, true);
+    } 
+    return make_ref<T>(parser, slot);
+  }
+
+
+// strict conversion: the whole token has to be consumed, no locale, no
+// exceptions. Returns false if s is not a valid T.
+template <typename T>
+bool convert(std::string_view s, T & out) {
+  if constexpr (std::is_same_v<T, bool>) {
+    if (s == "true" || s == "1" || s == "yes") {
+      out = true;
+    } else if (s == "false" || s == "0" || s == "no") {
+      out = false;
+    } else {
+      return false;
+    }
+    return true;
+  } else if constexpr (std::is_same_v<T, std::string> || std::is_same_v<T, std::string_view>) {
+    out = T(s);
+    return true;
+  } else {
+    static_assert(std::is_arithmetic_v<T>, "no conversion for this type");
+    const char *first = s.data();
+    const char *last = s.data() + s.size();
+    if (first != last && *first == '+' && last - first > 1 && first[1] != '-') {
+      first++; // from_chars does not take a leading '+'
+    }
+    auto [ptr, ec] = std::from_chars(first, last, out);
+    return ec == std::errc() && ptr == last && first != last;
+  }
+}
+
+template <typename T>
+struct is_list_type : std::false_type {};
+
+template <typename T>
+struct is_list_type<std::vector<T>> : std::true_type {};
+
+// calls f on every comma separated element of s. The separators are found 16
+// bytes at a time with SSE2, the tail (and non-x86 builds) use a scalar loop.
+template <typename F>
+bool for_each_list_element(std::string_view s, F && f) {
+  std::size_t begin = 0;
+  std::size_t i = 0;
+#if defined(__SSE2__)
+  const __m128i comma = _mm_set1_epi8(',');
+  for (; i + 16 <= s.size(); i += 16) {
+    __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s.data() + i));
+    unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, comma)));
+    while (mask != 0) {
+      std::size_t pos = i + __builtin_ctz(mask);
+      if (!f(s.substr(begin, pos - begin))) {
+        return false;
+      }
+      begin = pos + 1;
+      mask &= mask - 1;
+    }
+  }
+#endif
+  for (; i < s.size(); i++) {
+    if (s[i] == ',') {
+      if (!f(s.substr(begin, i - begin))) {
+        return false;
+      }
+      begin = i + 1;
+    }
+  }
+  return f(s.substr(begin));
+}
+
+std::size_t count_list_elements(std::string_view s) {
+  std::size_t commas = 0;
+  std::size_t i = 0;
+#if defined(__SSE2__)
+  const __m128i comma = _mm_set1_epi8(',');
+  for (; i + 16 <= s.size(); i += 16) {
+    __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s.data() + i));
+    commas += __builtin_popcount(static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, comma))));
+  }
+#endif
+  for (; i < s.size(); i++) {
+    commas += s[i] == ',';
+  }
+  return commas + 1;
+}
+
+// appends the elements of "1024,2048,4096" to out. The buffer is grown once,
+// elements are converted in place.
+template <typename T>
+bool parse_list(std::string_view s, std::vector<T> & out) {
+  std::size_t next = out.size();
+  out.resize(next + count_list_elements(s));
+  return for_each_list_element(s, [&](std::string_view element) {
+    return convert(element, out[next++]);
+  });
+}
+
+// string arguments keep a view of the token, argv outlives the parse result.
+// A list that is already in out (the flag was repeated) is appended to.
+template <typename T>
+bool convert_to_variant(std::string_view s, AllowedArgTypes & out) {
+  if constexpr (std::is_same_v<T, std::string> || std::is_same_v<T, std::string_view>) {
+    out.emplace<std::string_view>(s);
+    return true;
+  } else if constexpr (is_list_type<T>::value) {
+    T *list = std::get_if<T>(&out);
+    return parse_list(s, list ? *list : out.emplace<T>());
+  } else {
+    return convert(s, out.emplace<T>());
+  }
+}
+
+// convert s to the alternative of AllowedArgTypes at type_index
+template <std::size_t... I>
+bool convert_value(std::size_t type_index, std::string_view s, AllowedArgTypes & out, std::index_sequence<I...>) {
+  using Converter = bool (*)(std::string_view, AllowedArgTypes &);
+  static constexpr Converter converters[] = {&convert_to_variant<std::variant_alternative_t<I, AllowedArgTypes>>...};
+  return converters[type_index](s, out);
+}
+
+bool convert_value(std::size_t type_index, std::string_view s, AllowedArgTypes & out) {
+  return convert_value(type_index, s, out, std::make_index_sequence<std::variant_size_v<AllowedArgTypes>>{});
+}
+
+template <std::size_t... I>
+bool is_list_index(std::size_t type_index, std::index_sequence<I...>) {
+  static constexpr bool lists[] = {is_list_type<std::variant_alternative_t<I, AllowedArgTypes>>::value...};
+  return lists[type_index];
+}
+
+bool is_list_index(std::size_t type_index) {
+  return is_list_index(type_index, std::make_index_sequence<std::variant_size_v<AllowedArgTypes>>{});
+}
+
+const char *type_name(std::size_t type_index) {
+  static constexpr const char *names[] = {"int", "bool", "float", "string", "string_view", "int64", "unsigned", "uint64", "double",
+                                              "int list", "float list"};
+  static_assert(std::size(names) == std::variant_size_v<AllowedArgTypes>, "type_name is out of date");
+  return names[type_index];
+}
+
+// ---------------------------------------------------------------------------
+// value constraints
+//
+// add_range, add_choices and add_pattern constrain the value of one argument
+// and return its ref, so they wrap the add_*_argument call:
+//   auto batch_size = add_range(args, add_optional_argument(args, "--batch-size", ...), 1, 65536);
+// add_check adds a predicate over several values. The per-value checks are
+// kept in one array sorted by slot and try_parse_args runs them in a single
+// merge with its sorted values. Defaults are checked once, when the
+// constraint is added.
+// ---------------------------------------------------------------------------
+
+template <typename T>
+constexpr bool is_number_type = std::is_arithmetic_v<T> && !std::is_same_v<T, bool>;
+
+template <typename T>
+constexpr bool is_string_type = std::is_same_v<T, std::string> || std::is_same_v<T, std::string_view>;
+
+// the first number of value (a number or a list) outside [lo, hi], nullopt if
+// all are inside. NaN is never inside.
+std::optional<double> out_of_range(const AllowedArgTypes & value, double lo, double hi) {
+  return std::visit([&](const auto & v) -> std::optional<double> {
+    using V = std::decay_t<decltype(v)>;
+    if constexpr (is_number_type<V>) {
+      double d = static_cast<double>(v);
+      if (!(d >= lo && d <= hi)) {
+        return d;
+      }
+    } else if constexpr (is_list_type<V>::value) {
+      for (double d : v) {
+        if (!(d >= lo && d <= hi)) {
+          return d;
+        }
+      }
+    }
+    return std::nullopt;
+  }, value);
+}
+
+// string values are string_views into argv or a file, defaults std::strings
+std::string_view string_value(const AllowedArgTypes & value) {
+  if (const std::string_view *s = std::get_if<std::string_view>(&value)) {
+    return *s;
+  }
+  if (const std::string *s = std::get_if<std::string>(&value)) {
+    return *s;
+  }
+  return {};
+}
+
+// the position of the first character of s not in the set of check, s.size()
+// if only the length is wrong, npos if s matches
+std::size_t pattern_mismatch(const ArgSchema & schema, const ValueCheck & check, std::string_view s) {
+  const CharSet & allowed = schema.mCharSets[check.first];
+  for (std::size_t i = 0; i < s.size(); i++) {
+    if (!allowed.contains(static_cast<unsigned char>(s[i]))) {
+      return i;
+    }
+  }
+  bool size_ok = static_cast<double>(s.size()) >= check.lo && static_cast<double>(s.size()) <= check.hi;
+  return size_ok ? std::string_view::npos : s.size();
+}
+
+bool check_value(const ArgSchema & schema, const ValueCheck & check, const AllowedArgTypes & value) {
+  switch (check.kind) {
+    case CheckKind::Range:
+      return !out_of_range(value, check.lo, check.hi).has_value();
+    case CheckKind::Choices: {
+      std::string_view s = string_value(value);
+      for (std::uint32_t i = check.first; i < check.first + check.count; i++) {
+        if (pool_view(schema.mStrings, schema.mChoices[i]) == s) {
+          return true;
+        }
+      }
+      return false;
+    }
+    case CheckKind::Pattern:
+      return pattern_mismatch(schema, check, string_value(value)) == std::string_view::npos;
+  }
+  return true;
+}
+
+// inserts check behind the other checks of its slot. A default that breaks it
+// is a mistake in the schema, not in the input.
+void add_value_check(ArgsParser & parser, const ValueCheck & check) {
+  ArgSchema & schema = mutable_schema(parser);
+  const Argument & arg = schema.mArguments[check.slot];
+  if (arg.has_default() && !check_value(schema, check, arg.value)) {
+    ARGS_THROW(std::logic_error("invalid args: the default of " + std::string(arg_key(schema, check.slot)) +
+                                " breaks its constraint"));
+  }
+  auto at = std::upper_bound(schema.mValueChecks.begin(), schema.mValueChecks.end(), check.slot,
+                             [](std::uint32_t slot, const ValueCheck & c) { return slot < c.slot; });
+  schema.mValueChecks.insert(at, check);
+}
+
+// a number, or every element of a list, has to lie in [lo, hi]. Values are
+// compared as double.
+template <typename T>
+CmdlineArgRef<T> add_range(ArgsParser & parser, const CmdlineArgRef<T> & ref, double lo, double hi) {
+    static_assert(is_number_type<T> || is_list_type<T>::value, "add_range needs a number or list argument");
+    add_value_check(parser, ValueCheck{static_cast<std::uint32_t>(ref.slot), CheckKind::Range, 0, 0, lo, hi});
+    return ref;
+}
+
+// the string has to be one of choices
+template <typename T>
+CmdlineArgRef<T> add_choices(ArgsParser & parser, const CmdlineArgRef<T> & ref,
+                             std::initializer_list<std::string_view> choices) {
+    static_assert(is_string_type<T>, "add_choices needs a string argument");
+    ArgSchema & schema = mutable_schema(parser);
+    std::uint32_t first = static_cast<std::uint32_t>(schema.mChoices.size());
+    for (std::string_view choice : choices) {
+      schema.mChoices.push_back(intern(schema.mStrings, choice));
+    }
+    add_value_check(parser, ValueCheck{static_cast<std::uint32_t>(ref.slot), CheckKind::Choices, first,
+                                       static_cast<std::uint32_t>(choices.size())});
+    return ref;
+}
+
+// the string has to be min_size to max_size characters, all of them in allowed
+template <typename T>
+CmdlineArgRef<T> add_pattern(ArgsParser & parser, const CmdlineArgRef<T> & ref, const CharSet & allowed,
+                             std::size_t min_size = 1, std::size_t max_size = SIZE_MAX) {
+    static_assert(is_string_type<T>, "add_pattern needs a string argument");
+    ArgSchema & schema = mutable_schema(parser);
+    schema.mCharSets.push_back(allowed);
+    add_value_check(parser, ValueCheck{static_cast<std::uint32_t>(ref.slot), CheckKind::Pattern,
+                                       static_cast<std::uint32_t>(schema.mCharSets.size() - 1), 0,
+                                       static_cast<double>(min_size), static_cast<double>(max_size)});
+    return ref;
+}
+
+// predicate(values of refs...) has to hold, defaults included, or the parse
+// fails with message. It runs once everything else passed and is skipped if
+// one of refs has no value. Called from several threads under
+// parse_args_batch.
+template <typename F, typename... T>
+void add_check(ArgsParser & parser, const std::string & message, F predicate, const CmdlineArgRef<T> &... refs) {
+    ArgSchema & schema = mutable_schema(parser);
+    PooledString pooled_message = intern(schema.mStrings, message);
+    schema.mCrossChecks.push_back(CrossCheck{pooled_message, [predicate, refs...](const ArgsParser & result) {
+      if (!(try_get(result, refs).ok() && ...)) {
+        return true;
+      }
+      return static_cast<bool>(predicate(*try_get(result, refs).value...));
+    }});
+}
+
+// ---------------------------------------------------------------------------
+// parse errors
+//
+// try_parse_args reports what went wrong as ParseError values instead of
+// throwing: a code, the argv index of the offending token and a view of its
+// text. They are formatted only when someone asks for the message, so a
+// rejected candidate costs one vector entry per problem and a clean parse
+// nothing at all.
+// ---------------------------------------------------------------------------
+
+enum class ParseErrc : std::uint8_t {
+    Help,              // -h or --help, parsing stops there
+    NotAFlag,          // a token that is neither a flag nor a value
+    UnknownKey,        // text is the key
+    AmbiguousKey,      // an abbreviation of several keys, text is the key
+    MissingValue,      // index is the slot
+    BadValue,          // index is the slot, text the value
+    Required,          // index is the slot
+    Exclusive,         // index is the group in ArgSchema::mExclusiveGroups
+    OneOf,             // index is the group in ArgSchema::mOneOfGroups
+    Requires,          // index is the pair in ArgSchema::mRequires
+    OutOfRange,        // index is the check in ArgSchema::mValueChecks
+    NotAChoice,        // index is the check in ArgSchema::mValueChecks
+    BadPattern,        // index is the check in ArgSchema::mValueChecks
+    CheckFailed,       // index is the check in ArgSchema::mCrossChecks
+    ResponseFileOpen,  // text is the path
+    ResponseFileQuote, // text is the path
+    ResponseFileCycle, // text is the path that includes itself again
+    IncludedFrom,      // note after ResponseFileCycle, one per enclosing file, innermost first
+    ConfigFileOpen,    // the schema's config file
+    ConfigFileLine,    // index is the line number
+    NoSlot,            // try_get: the ref is not from this parser
+    NoValue,           // try_get: index is the slot
+};
+
+constexpr int kNoToken = -1; // the error is not about one command line token
+
+struct ParseError {
+    ParseErrc code;
+    int token = kNoToken; // argv index, for tokens from a response file the index of its @file
+    std::uint32_t index = 0;
+    std::string_view text; // points into argv, a mapped file or the environment
+};
+
+// ---------------------------------------------------------------------------
+// response files
+//
+// "@path" expands to the arguments stored in path, separated by whitespace.
+// '...' and "..." group a token and a '#' at the start of a token comments out
+// the rest of the line. The file is mapped and tokenized in place, the tokens
+// point into the mapping. Response files can include other response files.
+// ---------------------------------------------------------------------------
+
+bool is_space(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+}
+
+// splits the mapping into '\0' terminated tokens, in place. False if a quote
+// is left open.
+bool tokenize_in_place(MappedFile & file, std::pmr::vector<const char *> & tokens) {
+  char *p = file.data;
+  char *end = file.data + file.size;
+  while (p < end) {
+    if (is_space(*p)) {
+      p++;
+      continue;
+    }
+    if (*p == '#') {
+      while (p < end && *p != '\n') {
+        p++;
+      }
+      continue;
+    }
+    char *token = p;
+    char *out = p; // unquoting only ever shrinks the token
+    char quote = 0;
+    while (p < end && (quote != 0 || !is_space(*p))) {
+      if (quote == 0 && (*p == '\'' || *p == '"')) {
+        quote = *p++;
+      } else if (quote != 0 && *p == quote) {
+        quote = 0;
+        p++;
+      } else {
+        *out++ = *p++;
+      }
+    }
+    if (quote != 0) {
+      return false;
+    }
+    // out <= p and data[size] is writable, so this never writes past the mapping
+    *out = '\0';
+    p++;
+    tokens.push_back(token);
+  }
+  return true;
+}
+
+bool has_response_file(int argc, const char **argv) {
+  for (int i = 1; i < argc; i++) {
+    if (argv[i][0] == '@') {
+      return true;
+    }
+  }
+  return false;
+}
+
+// a response file being expanded. path points into argv or into the mapping
+// of the file that included it.
+struct OpenResponseFile {
+  struct stat st;
+  std::string_view path;
+};
+
+// appends the tokens of path to tokens, expanding nested @files. open_files
+// holds the files currently being expanded, to catch include cycles. origin is
+// the argv index of the @file, recorded for each token and each error.
+void expand_response_file(std::string_view path, int origin, std::pmr::vector<const char *> & tokens,
+                          std::pmr::vector<int> & origins, std::pmr::vector<std::shared_ptr<MappedFile>> & files,
+                          std::vector<OpenResponseFile> & open_files, std::pmr::vector<ParseError> & errors) {
+  struct stat st;
+  std::shared_ptr<MappedFile> file = try_map_file(std::string(path), &st);
+  if (file == nullptr) {
+    errors.push_back(ParseError{ParseErrc::ResponseFileOpen, origin, 0, path});
+    return;
+  }
+  for (const OpenResponseFile & open : open_files) {
+    if (open.st.st_dev == st.st_dev && open.st.st_ino == st.st_ino) {
+      errors.push_back(ParseError{ParseErrc::ResponseFileCycle, origin, 0, path});
+      for (auto it = open_files.rbegin(); it != open_files.rend(); ++it) {
+        errors.push_back(ParseError{ParseErrc::IncludedFrom, origin, 0, it->path});
+      }
+      return;
+    }
+  }
+  files.push_back(file);
+  open_files.push_back(OpenResponseFile{st, path});
+
+  std::pmr::vector<const char *> file_tokens(tokens.get_allocator());
+  if (!tokenize_in_place(*file, file_tokens)) {
+    errors.push_back(ParseError{ParseErrc::ResponseFileQuote, origin, 0, path});
+  }
+  for (const char *token : file_tokens) {
+    if (token[0] == '@') {
+      expand_response_file(token + 1, origin, tokens, origins, files, open_files, errors);
+    } else {
+      tokens.push_back(token);
+      origins.push_back(origin);
+    }
+  }
+  open_files.pop_back();
+}
+
+// argv with every @file replaced by its tokens, in the resource of origins.
+// origins[i] is the argv index tokens[i] came from.
+std::pmr::vector<const char *> expand_response_files(int argc, const char **argv, std::pmr::vector<int> & origins,
+                                                     std::pmr::vector<std::shared_ptr<MappedFile>> & files,
+                                                     std::pmr::vector<ParseError> & errors) {
+  std::pmr::vector<const char *> tokens(argv, argv + 1, origins.get_allocator());
+  origins.assign(1, 0);
+  std::vector<OpenResponseFile> open_files;
+  for (int i = 1; i < argc; i++) {
+    if (argv[i][0] == '@') {
+      expand_response_file(argv[i] + 1, i, tokens, origins, files, open_files, errors);
+    } else {
+      tokens.push_back(argv[i]);
+      origins.push_back(i);
+    }
+  }
+  return tokens;
+}
+
+// ---------------------------------------------------------------------------
+// config file and environment layers
+//
+// Values are converted while parsing, not on their first read: results store
+// typed values (see ArgValue), and bad values and constraints are reported by
+// the parse. So every registered key in the config file is converted, read
+// by the program or not. Only unregistered keys and keys a higher layer
+// already set are skipped without conversion.
+// ---------------------------------------------------------------------------
+
+std::string_view trim(std::string_view s) {
+  while (!s.empty() && is_space(s.front())) {
+    s.remove_prefix(1);
+  }
+  while (!s.empty() && is_space(s.back())) {
+    s.remove_suffix(1);
+  }
+  return s;
+}
+
+// calls f(key, value) for each "key = value" line, without copying anything.
+// Keys may be written bare (batch-size) or as flags (--batch-size, -ll:gpus).
+// Stops at the first line that is neither and returns its number, 0 if every
+// line was read.
+template <typename F>
+int for_each_config_entry(const MappedFile & file, F && f) {
+  std::string_view rest(file.data, file.size);
+  for (int line_no = 1; !rest.empty(); line_no++) {
+    std::size_t eol = rest.find('\n');
+    std::string_view line = trim(rest.substr(0, eol));
+    rest.remove_prefix(eol == std::string_view::npos ? rest.size() : eol + 1);
+    if (line.empty() || line.front() == '#') {
+      continue;
+    }
+    std::size_t eq = line.find('=');
+    if (eq == std::string_view::npos) {
+      return line_no;
+    }
+    std::string_view key = trim(line.substr(0, eq));
+    std::string_view value = trim(line.substr(eq + 1));
+    if (value.size() >= 2 && (value.front() == '"' || value.front() == '\'') && value.back() == value.front()) {
+      value = value.substr(1, value.size() - 2);
+    }
+    f(key.substr(0, 1) == "-" ? parseKeyView(key) : key, value);
+  }
+  return 0;
+}
+
+// calls f(slot) for every set bit of a & ~b (or of a if b is null), word by word
+template <typename F>
+void for_each_bit(const SlotBitset & a, const SlotBitset * b, bool negate_b, F && f) {
+  for (std::size_t w = 0; w < a.size(); w++) {
+    std::uint64_t other = b != nullptr && w < b->size() ? (*b)[w] : 0;
+    for (std::uint64_t bits = a[w] & (negate_b ? ~other : other); bits != 0; bits &= bits - 1) {
+      f(w * 64 + __builtin_ctzll(bits));
+    }
+  }
+}
+
+std::string join_keys(const ArgSchema & schema, const SlotBitset & group, const SlotBitset * passed) {
+  std::string keys;
+  for_each_bit(group, passed, passed == nullptr, [&](std::size_t slot) {
+    keys += (keys.empty() ? "" : ", ") + std::string(arg_key(schema, slot));
+  });
+  return keys;
+}
+
+// checks every constraint of the schema against the supplied slots with word
+// wide bit operations and reports all violations, not just the first
+void validate_constraints(const ArgSchema & schema, const SlotBitset & passed, std::pmr::vector<ParseError> & errors) {
+  for_each_bit(schema.mRequired, &passed, true, [&](std::size_t slot) {
+    errors.push_back(ParseError{ParseErrc::Required, kNoToken, static_cast<std::uint32_t>(slot), {}});
+  });
+  for (std::size_t g = 0; g < schema.mExclusiveGroups.size(); g++) {
+    const SlotBitset & group = schema.mExclusiveGroups[g];
+    std::size_t count = 0;
+    for (std::size_t w = 0; w < group.size() && w < passed.size(); w++) {
+      count += __builtin_popcountll(group[w] & passed[w]);
+    }
+    if (count > 1) {
+      errors.push_back(ParseError{ParseErrc::Exclusive, kNoToken, static_cast<std::uint32_t>(g), {}});
+    }
+  }
+  for (std::size_t g = 0; g < schema.mOneOfGroups.size(); g++) {
+    const SlotBitset & group = schema.mOneOfGroups[g];
+    bool any = false;
+    for (std::size_t w = 0; w < group.size() && w < passed.size() && !any; w++) {
+      any = (group[w] & passed[w]) != 0;
+    }
+    if (!any) {
+      errors.push_back(ParseError{ParseErrc::OneOf, kNoToken, static_cast<std::uint32_t>(g), {}});
+    }
+  }
+  for (std::size_t r = 0; r < schema.mRequires.size(); r++) {
+    const auto & [a, b] = schema.mRequires[r];
+    if (test_bit(passed, a) && !test_bit(passed, b)) {
+      errors.push_back(ParseError{ParseErrc::Requires, kNoToken, static_cast<std::uint32_t>(r), {}});
+    }
+  }
+}
+
+ParseErrc check_errc(CheckKind kind) {
+  switch (kind) {
+    case CheckKind::Range:
+      return ParseErrc::OutOfRange;
+    case CheckKind::Choices:
+      return ParseErrc::NotAChoice;
+    case CheckKind::Pattern:
+      return ParseErrc::BadPattern;
+  }
+  return ParseErrc::OutOfRange;
+}
+
+// runs the value constraints over result.mValues, sorted by slot, in one
+// merge with the sorted checks. Defaults passed theirs when they were added,
+// slots in bad hold no real value and are skipped. The cross-field checks
+// follow if nothing failed so far.
+void validate_values(const ArgsParser & result, const SlotBitset & bad, std::pmr::vector<ParseError> & errors) {
+  const ArgSchema & schema = *result.mSchema;
+  const std::vector<ValueCheck> & checks = schema.mValueChecks;
+  std::size_t c = 0;
+  for (std::size_t v = 0; v < result.mValues.size() && c < checks.size(); v++) {
+    const ArgValue & value = result.mValues[v];
+    while (c < checks.size() && checks[c].slot < value.slot) {
+      c++;
+    }
+    if (test_bit(bad, value.slot)) {
+      continue;
+    }
+    for (std::size_t k = c; k < checks.size() && checks[k].slot == value.slot; k++) {
+      if (!check_value(schema, checks[k], value.value)) {
+        errors.push_back(ParseError{check_errc(checks[k].kind), kNoToken, static_cast<std::uint32_t>(k), {}});
+      }
+    }
+  }
+  for (std::size_t k = 0; k < schema.mCrossChecks.size() && errors.empty(); k++) {
+    if (!schema.mCrossChecks[k].predicate(result)) {
+      errors.push_back(ParseError{ParseErrc::CheckFailed, kNoToken, static_cast<std::uint32_t>(k), {}});
+    }
+  }
+}
+
+// the outcome of try_parse_args: the parse if errors is empty. The result is
+// kept on failure too, it owns the schema and the files the errors point into.
+struct ParseOutcome {
+  ArgsParser result;
+  std::pmr::vector<ParseError> errors; // in the order they were found, command line first, same resource as result
+
+  bool ok() const { return errors.empty(); }
+  explicit operator bool() const { return ok(); }
+};
+
+// keep_unknown is parse_known_args: positional arguments, unknown keys with
+// their values and everything from a "--" on go to mPassThrough instead of
+// failing. Abbreviations are off in that mode, an unknown flag that happens
+// to prefix a registered key belongs to the downstream runtime. Never throws
+// for bad input, every problem becomes a ParseError
+// and parsing goes on with the next token. Everything the parse allocates,
+// result, errors and scratch, comes from resource.
+ParseOutcome try_parse_args(const ArgsParser & mArgs, int argc, const char **argv, bool keep_unknown = false,
+                            std::pmr::memory_resource *resource = std::pmr::get_default_resource()) {
+    int i  = 1;
+    const ArgSchema & schema = *mArgs.mSchema;
+    // the schema is shared, nothing from it is copied
+    ParseOutcome outcome{ArgsParser(mArgs.mSchema, resource), std::pmr::vector<ParseError>(resource)};
+    ArgsParser & result = outcome.result;
+    std::pmr::vector<ParseError> & errors = outcome.errors;
+    // slots supplied by any layer, i.e. the ones with an entry in result.mValues
+    SlotBitset passed((schema.mArguments.size() + 63) / 64, resource);
+    // slots whose value failed to convert, their constraints are not checked.
+    // Stays empty, and unallocated, on a clean parse.
+    SlotBitset bad(resource);
+
+    // every layer goes through here. Layers are applied from the highest
+    // precedence down, so a value that is overridden is never converted.
+    auto assign = [&](std::size_t slot, std::string_view raw, ValueSource source, int token) {
+        const Argument & arg = schema.mArguments[slot];
+        ArgValue *entry = nullptr;
+        if (test_bit(passed, slot)) {
+            // only a repeated flag or config line of the same layer gets here
+            for (auto it = result.mValues.rbegin(); entry == nullptr; ++it) {
+                entry = it->slot == slot ? &*it : nullptr;
+            }
+            if (entry->source > source) {
+                return;
+            }
+        } else {
+            set_bit(passed, slot);
+            entry = &result.mValues.emplace_back(ArgValue{static_cast<std::uint32_t>(slot), source, false, {}});
+        }
+
+        if (arg.is_store_true() && source != ValueSource::CommandLine) {
+            // store_true flags from a file or the environment carry true/false
+            bool passed = false;
+            if (!convert(raw, passed)) {
+                errors.push_back(ParseError{ParseErrc::BadValue, token, static_cast<std::uint32_t>(slot), raw});
+                set_bit(bad, slot);
+            }
+            entry->value = AllowedArgTypes{passed};
+            entry->is_store_passed = passed;
+        } else if (arg.is_store_true()) {
+            entry->value = AllowedArgTypes{true};
+            entry->is_store_passed = true;
+        } else {
+            // a repeated list flag appends, anything else replaces the default
+            bool append = entry->is_store_passed && is_list_index(arg.type_index);
+            if (!append) {
+                entry->value.emplace<0>();
+            }
+            AllowedArgTypes & value = entry->value;
+            entry->is_store_passed = true;
+            if (!convert_value(arg.type_index, raw, value)) {
+                errors.push_back(ParseError{ParseErrc::BadValue, token, static_cast<std::uint32_t>(slot), raw});
+                set_bit(bad, slot);
+            }
+        }
+        entry->source = source;
+    };
+
+    // @file tokens are replaced by the file contents, the result keeps the
+    // mappings alive because values point into them. origins maps the
+    // expanded tokens back to argv for error reports.
+    std::pmr::vector<const char *> expanded(resource);
+    std::pmr::vector<int> origins(resource);
+    if (has_response_file(argc, argv)) {
+        expanded = expand_response_files(argc, argv, origins, result.mMappedFiles, errors);
+        argc = static_cast<int>(expanded.size());
+        argv = expanded.data();
+    }
+    auto origin = [&](int token) { return origins.empty() ? token : origins[token]; };
+    // room for one value per token, so the vector is not regrown (and in an
+    // arena, not left behind in pieces) by the command line layer
+    result.mValues.reserve(std::min<std::size_t>(argc > 1 ? argc - 1 : 0, schema.mArguments.size()));
+
+    // keys and values stay slices of argv, the loop itself does not allocate
+    while (i  < argc) {
+        if (keep_unknown && (argv[i][0] != '-' || std::strcmp(argv[i], "--") == 0)) {
+            bool rest = argv[i][0] == '-';
+            int end = rest ? argc : i + 1;
+            result.mPassThrough.insert(result.mPassThrough.end(), argv + i, argv + end);
+            i = end;
+            continue;
+        }
+        if (argv[i][0] != '-') {
+            errors.push_back(ParseError{ParseErrc::NotAFlag, origin(i), 0, argv[i]});
+            i++;
+            continue;
+        }
+        std::string_view key = parseKeyView(argv[i]);
+        if (key == "help" || key == "-h") {
+            errors.push_back(ParseError{ParseErrc::Help, origin(i), 0, argv[i]});
+            return outcome;
+        }
+
+        std::size_t slot = find_slot(schema, key);
+        bool has_value = i + 1 < argc && argv[i + 1][0] != '-';
+        if (slot == kNoSlot) {
+            std::string_view ns = key_namespace(key);
+            if (const NamespaceHandler *handler = ns.empty() ? nullptr : find_namespace_handler(schema, ns)) {
+                (*handler)(key, has_value ? argv[i + 1] : std::string_view());
+                i += has_value ? 2 : 1;
+                continue;
+            }
+            if (!ns.empty() && trie_find(schema.mKeyTrie, ns) == 0) {
+                // a namespace nobody registered here, kept for whoever owns it
+                result.mPassThrough.insert(result.mPassThrough.end(), argv + i, argv + i + (has_value ? 2 : 1));
+                i += has_value ? 2 : 1;
+                continue;
+            }
+            slot = keep_unknown ? kNoSlot : find_abbreviated_slot(schema, key);
+            if (slot == kAmbiguousSlot) {
+                errors.push_back(ParseError{ParseErrc::AmbiguousKey, origin(i), 0, key});
+                i += has_value ? 2 : 1;
+                continue;
+            }
+            if (slot == kNoSlot && keep_unknown) {
+                result.mPassThrough.insert(result.mPassThrough.end(), argv + i, argv + i + (has_value ? 2 : 1));
+                i += has_value ? 2 : 1;
+                continue;
+            }
+        }
+        if(slot != kNoSlot && schema.mArguments[slot].is_store_true()) {
+            assign(slot, {}, ValueSource::CommandLine, origin(i));
+            i++;
+            continue; 
+        }
+
+        if (slot == kNoSlot) {
+            // a misspelled switch without a value is as wrong as one with
+            errors.push_back(ParseError{ParseErrc::UnknownKey, origin(i), 0, key});
+            i += has_value ? 2 : 1;
+        } else if (has_value) {
+            assign(slot, argv[i + 1], ValueSource::CommandLine, origin(i + 1));
+            i += 2; 
+        } else {
+            errors.push_back(ParseError{ParseErrc::MissingValue, origin(i), static_cast<std::uint32_t>(slot), key});
+            i++; 
+        }
+    }
+
+    // a slot already set on the command line is skipped, so is a variable
+    // that appears twice in environ (getenv would also see only the first)
+    for_each_env_entry(schema, [&](std::size_t slot, const char *raw) {
+        if (!test_bit(passed, slot)) {
+            assign(slot, raw, ValueSource::Environment, kNoToken);
+        }
+    });
+
+    // the config file is only split into lines here. Registered keys are
+    // converted now whether or not they are read later, see the layers
+    // section. Unregistered keys and keys a higher layer set are not.
+    if (!schema.mConfigFile.empty()) {
+        std::shared_ptr<MappedFile> file = try_map_file(schema.mConfigFile);
+        int bad_line = 0;
+        if (file != nullptr) {
+            result.mMappedFiles.push_back(file);
+            bad_line = for_each_config_entry(*file, [&](std::string_view key, std::string_view raw) {
+                std::size_t slot = find_slot(schema, key);
+                if (slot != kNoSlot) {
+                    assign(slot, raw, ValueSource::ConfigFile, kNoToken);
+                }
+            });
+        }
+        if (file == nullptr) {
+            errors.push_back(ParseError{ParseErrc::ConfigFileOpen, kNoToken, 0, schema.mConfigFile});
+        } else if (bad_line != 0) {
+            errors.push_back(ParseError{ParseErrc::ConfigFileLine, kNoToken, static_cast<std::uint32_t>(bad_line),
+                                        schema.mConfigFile});
+        }
+    }
+
+    validate_constraints(schema, passed, errors);
+    std::sort(result.mValues.begin(), result.mValues.end(),
+              [](const ArgValue & a, const ArgValue & b) { return a.slot < b.slot; });
+    if (!schema.mValueChecks.empty() || !schema.mCrossChecks.empty()) {
+        validate_values(result, bad, errors);
+    }
+    return outcome;
+  }
+
+ParseOutcome try_parse_args(const ArgsParser & mArgs, int argc, const char **argv, std::pmr::memory_resource *resource) {
+    return try_parse_args(mArgs, argc, argv, false, resource);
+}
+
+// parses the known keys and keeps everything else, see parse_known_args
+ParseOutcome try_parse_known_args(const ArgsParser & mArgs, int argc, const char **argv) {
+    return try_parse_args(mArgs, argc, argv, true);
+}
+
+// the errors that throw on their own, the others are collected under
+// "invalid args:"
+bool is_fatal_error(ParseErrc code) {
+  switch (code) {
+    case ParseErrc::BadValue:
+    case ParseErrc::Required:
+    case ParseErrc::Exclusive:
+    case ParseErrc::OneOf:
+    case ParseErrc::Requires:
+    case ParseErrc::OutOfRange:
+    case ParseErrc::NotAChoice:
+    case ParseErrc::BadPattern:
+    case ParseErrc::CheckFailed:
+    case ParseErrc::IncludedFrom: // printed with the error it follows
+      return false;
+    default:
+      return true;
+  }
+}
+
+// slots that got a value, for the messages of the group constraints
+SlotBitset passed_slots(const ArgsParser & result) {
+  SlotBitset passed;
+  for (const ArgValue & value : result.mValues) {
+    set_bit(passed, value.slot);
+  }
+  return passed;
+}
+
+std::string number_text(double d) {
+  char buffer[32];
+  auto [end, ec] = std::to_chars(buffer, buffer + sizeof(buffer), d);
+  return ec == std::errc() ? std::string(buffer, end) : std::to_string(d);
+}
+
+// why the supplied value broke check, "batch-size: 0 is not in [1, 65536]"
+std::string value_check_message(const ArgsParser & result, const ValueCheck & check) {
+  const ArgSchema & schema = *result.mSchema;
+  const AllowedArgTypes & value = find_value(result, check.slot)->value;
+  std::string message = std::string(arg_key(schema, check.slot)) + ": ";
+  switch (check.kind) {
+    case CheckKind::Range:
+      return message + number_text(out_of_range(value, check.lo, check.hi).value_or(0)) + " is not in [" +
+             number_text(check.lo) + ", " + number_text(check.hi) + "]";
+    case CheckKind::Choices: {
+      message += "'" + std::string(string_value(value)) + "' is not one of ";
+      for (std::uint32_t i = check.first; i < check.first + check.count; i++) {
+        message += (i == check.first ? "" : ", ") + std::string(pool_view(schema.mStrings, schema.mChoices[i]));
+      }
+      return message;
+    }
+    case CheckKind::Pattern: {
+      std::string_view s = string_value(value);
+      std::size_t at = pattern_mismatch(schema, check, s);
+      message += "'" + std::string(s) + "' ";
+      if (at < s.size()) {
+        return message + "has an invalid character '" + s[at] + "' at " + std::to_string(at);
+      }
+      if (check.hi >= static_cast<double>(SIZE_MAX)) {
+        return message + "needs at least " + number_text(check.lo) + " characters";
+      }
+      return message + "needs " + number_text(check.lo) + " to " + number_text(check.hi) + " characters";
+    }
+  }
+  return message;
+}
+
+// what the throwing API says about an error of result, the outcome of
+// try_parse_args or the parser try_get read. Collected errors are one line
+// each without the "invalid args:" header.
+std::string error_message(const ArgsParser & result, const ParseError & error) {
+  const ArgSchema & schema = *result.mSchema;
+  std::string text(error.text);
+  switch (error.code) {
+    case ParseErrc::Help:
+      return "help requested";
+    case ParseErrc::NotAFlag:
+      return "parse invalid args: " + text;
+    case ParseErrc::UnknownKey:
+      return unknown_key_message(schema, error.text);
+    case ParseErrc::AmbiguousKey:
+      return ambiguous_key_message(schema, error.text);
+    case ParseErrc::MissingValue:
+      return "required args: " + text + " needs a value";
+    case ParseErrc::BadValue: {
+      const Argument & arg = schema.mArguments[error.index];
+      return std::string(arg_key(schema, error.index)) + ": '" + text + "' is not a valid " +
+             (arg.is_store_true() ? "bool" : type_name(arg.type_index));
+    }
+    case ParseErrc::Required:
+      return std::string(arg_key(schema, error.index)) + " is required";
+    case ParseErrc::Exclusive: {
+      SlotBitset passed = passed_slots(result);
+      return "only one of " + join_keys(schema, schema.mExclusiveGroups[error.index], &passed) + " may be passed";
+    }
+    case ParseErrc::OneOf:
+      return "one of " + join_keys(schema, schema.mOneOfGroups[error.index], nullptr) + " is required";
+    case ParseErrc::Requires: {
+      const auto & [a, b] = schema.mRequires[error.index];
+      return std::string(arg_key(schema, a)) + " requires " + std::string(arg_key(schema, b));
+    }
+    case ParseErrc::OutOfRange:
+    case ParseErrc::NotAChoice:
+    case ParseErrc::BadPattern:
+      return value_check_message(result, schema.mValueChecks[error.index]);
+    case ParseErrc::CheckFailed:
+      return std::string(pool_view(schema.mStrings, schema.mCrossChecks[error.index].message));
+    case ParseErrc::ResponseFileOpen:
+      return "response file: cannot open " + text;
+    case ParseErrc::ResponseFileQuote:
+      return "response file: unterminated quote in " + text;
+    case ParseErrc::ResponseFileCycle:
+      return "response file: include cycle at " + text;
+    case ParseErrc::IncludedFrom:
+      return "  included from " + text;
+    case ParseErrc::ConfigFileOpen:
+      return "cannot open " + text;
+    case ParseErrc::ConfigFileLine:
+      return "config file " + text + ":" + std::to_string(error.index) + ": expected key = value";
+    case ParseErrc::NoSlot:
+      return "invalid args: slot " + std::to_string(error.index);
+    case ParseErrc::NoValue:
+      return "invalid args: " + std::string(arg_key(schema, error.index)) + " has no value";
+  }
+  return "invalid args";
+}
+
+// the message parse_args throws for a failed outcome: the first error that
+// stops a parse on its own with its notes, else all collected errors under
+// "invalid args:"
+std::string error_message(const ParseOutcome & outcome) {
+  for (auto it = outcome.errors.begin(); it != outcome.errors.end(); ++it) {
+    if (is_fatal_error(it->code)) {
+      std::string message = error_message(outcome.result, *it);
+      while (++it != outcome.errors.end() && it->code == ParseErrc::IncludedFrom) {
+        message += "\n" + error_message(outcome.result, *it);
+      }
+      return message;
+    }
+  }
+  std::string message = "invalid args:";
+  for (const ParseError & error : outcome.errors) {
+    message += "\n  " + error_message(outcome.result, error);
+  }
+  return message;
+}
+
+// how the throwing API ends a failed parse: -h / --help exits, anything
+// else throws error_message(outcome)
+[[noreturn]] void fail_parse(const ParseOutcome & outcome) {
+    auto fatal = std::find_if(outcome.errors.begin(), outcome.errors.end(),
+                              [](const ParseError & error) { return is_fatal_error(error.code); });
+    if (fatal != outcome.errors.end() && fatal->code == ParseErrc::Help) {
+        exit(1);
+    }
+    ARGS_THROW(std::runtime_error(error_message(outcome)));
+}
+
+// the throwing API on top of try_parse_args
+ArgsParser parse_args(const ArgsParser & mArgs, int argc, const char **argv, bool keep_unknown,
+                      std::pmr::memory_resource *resource = std::pmr::get_default_resource()) {
+    ParseOutcome outcome = try_parse_args(mArgs, argc, argv, keep_unknown, resource);
+    if (!outcome.ok()) {
+        fail_parse(outcome);
+    }
+    return std::move(outcome.result);
+}
+
+ArgsParser parse_args(const ArgsParser & mArgs, int argc, const char **argv) {
+    return parse_args(mArgs, argc, argv, false);
+}
+
+// the result lives in resource, e.g. a std::pmr::monotonic_buffer_resource
+// that a sweep worker releases after each batch of candidates
+ArgsParser parse_args(const ArgsParser & mArgs, int argc, const char **argv, std::pmr::memory_resource *resource) {
+    return parse_args(mArgs, argc, argv, false, resource);
+}
+
+// parses the known keys and keeps everything else, in order and without
+// copying, for whoever runs next (see leftover_args). Only exact keys are
+// known here, abbreviations are passed through like any unknown flag.
+ArgsParser parse_known_args(const ArgsParser & mArgs, int argc, const char **argv) {
+    return parse_args(mArgs, argc, argv, true);
+}
+
+// the entries parse_known_args did not consume, argv[0] not included. They
+// point into argv or into response files kept alive by result.
+ArgvView leftover_args(const ArgsParser & result) {
+    return ArgvView{static_cast<int>(result.mPassThrough.size()), const_cast<const char **>(result.mPassThrough.data())};
+}
+
+// which layer the value of ref came from
+template <typename T>
+ValueSource get_source(const ArgsParser & parser, const CmdlineArgRef<T> &ref) {
+    if(ref.slot >= parser.mSchema->mArguments.size()) {
+      ARGS_THROW(std::runtime_error("invalid args: slot " + std::to_string(ref.slot)));
+    }
+    const ArgValue *supplied = find_value(parser, ref.slot);
+    return supplied != nullptr ? supplied->source : ValueSource::Default;
+}
+
+// ---------------------------------------------------------------------------
+// get() profiling
+//
+// Build with -DARGS_PROFILE_GET to count get() calls per key, split their time
+// into lookup (finding the value) and conversion (extracting / copying it),
+// and remember where each key was first read from. The report goes to stderr
+// at exit, most called keys first. Without the define get() takes no extra
+// parameter and the macros below expand to nothing.
+// ---------------------------------------------------------------------------
+
+#ifdef ARGS_PROFILE_GET
+struct GetCallSite {
+  const char *file;
+  int line;
+  const char *function;
+
+  // evaluated at the caller when used as a default argument
+  static GetCallSite current(const char *file = __builtin_FILE(), int line = __builtin_LINE(),
+                             const char *function = __builtin_FUNCTION()) {
+    return GetCallSite{file, line, function};
+  }
+};
+
+struct GetProfile {
+  std::string key;
+  std::uint64_t calls = 0;
+  std::uint64_t lookup_ns = 0;
+  std::uint64_t convert_ns = 0;
+  GetCallSite first_site;
+  std::uint64_t first_seq = 0; // orders first calls across threads, see record_get
+};
+
+// (schema_id, slot) -> profile
+struct GetProfileKeyHash {
+  std::size_t operator()(const std::pair<std::uint64_t, std::size_t> & key) const {
+    return hash_mix(key.first * 0x9e3779b97f4a7c15ull ^ key.second);
+  }
+};
+using GetProfileTable = std::unordered_map<std::pair<std::uint64_t, std::size_t>, GetProfile, GetProfileKeyHash>;
+
+class GetProfiler {
+public:
+  // adds the table of a thread that is exiting
+  void merge(const GetProfileTable & table) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (const auto & [id, profile] : table) {
+      GetProfile & total = mProfiles[id];
+      if (total.calls == 0 || profile.first_seq < total.first_seq) {
+        total.key = profile.key;
+        total.first_site = profile.first_site;
+        total.first_seq = profile.first_seq;
+      }
+      total.calls += profile.calls;
+      total.lookup_ns += profile.lookup_ns;
+      total.convert_ns += profile.convert_ns;
+    }
+  }
+
+  ~GetProfiler() {
+    std::vector<const GetProfile *> sorted;
+    for (const auto & [id, profile] : mProfiles) {
+      sorted.push_back(&profile);
+    }
+    std::sort(sorted.begin(), sorted.end(), [](const GetProfile *a, const GetProfile *b) { return a->calls > b->calls; });
+    std::cerr << "get() profile: key, calls, lookup ns/call, convert ns/call, first call site" << std::endl;
+    for (const GetProfile *profile : sorted) {
+      std::cerr << "  " << profile->key << "  " << profile->calls << "  " << profile->lookup_ns / profile->calls << "  "
+                << profile->convert_ns / profile->calls << "  " << profile->first_site.file << ":"
+                << profile->first_site.line << " (" << profile->first_site.function << ")" << std::endl;
+    }
+  }
+
+private:
+  std::mutex mMutex;
+  std::map<std::pair<std::uint64_t, std::size_t>, GetProfile> mProfiles;
+};
+
+GetProfiler & get_profiler() {
+  static GetProfiler profiler; // destroyed, and so reported, at exit
+  return profiler;
+}
+
+// the get() calls of one thread. Threads never share a table, so recording
+// takes no lock; the table is merged into the process profile when the
+// thread exits, which for the main thread is before the report.
+struct ThreadGetProfiles {
+  GetProfiler & profiler = get_profiler();
+  GetProfileTable table;
+
+  ~ThreadGetProfiles() { profiler.merge(table); }
+};
+
+void record_get(const ArgSchema & schema, std::size_t slot, const GetCallSite & site, std::uint64_t lookup_ns,
+                std::uint64_t convert_ns) {
+  thread_local ThreadGetProfiles profiles;
+  GetProfile & profile = profiles.table[{schema.schema_id, slot}];
+  if (profile.calls++ == 0) {
+    // threads merge in the order they exit, the sequence tells which of
+    // their first calls really came first
+    static std::atomic<std::uint64_t> sequence{0};
+    profile.key = std::string(arg_key(schema, slot)); // copied once per slot and thread
+    profile.first_site = site;
+    profile.first_seq = sequence.fetch_add(1, std::memory_order_relaxed);
+  }
+  profile.lookup_ns += lookup_ns;
+  profile.convert_ns += convert_ns;
+}
+
+// times one get() call, the conversion phase runs from lookup_done() until
+// the call returns or throws
+class GetTimer {
+public:
+  GetTimer(const ArgsParser & parser, std::size_t slot, const GetCallSite & site)
+      : mParser(parser), mSlot(slot), mSite(site), mStart(std::chrono::steady_clock::now()), mLookupDone(mStart) {}
+
+  void lookup_done() { mLookupDone = std::chrono::steady_clock::now(); }
+
+  ~GetTimer() {
+    if (mSlot >= mParser.mSchema->mArguments.size()) {
+      return;
+    }
+    auto end = std::chrono::steady_clock::now();
+    auto ns = [](auto d) { return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count()); };
+    record_get(*mParser.mSchema, mSlot, mSite, ns(mLookupDone - mStart), ns(end - mLookupDone));
+  }
+
+private:
+  const ArgsParser & mParser;
+  std::size_t mSlot;
+  GetCallSite mSite;
+  std::chrono::steady_clock::time_point mStart;
+  std::chrono::steady_clock::time_point mLookupDone;
+};
+
+#define ARGS_GET_SITE_PARAM , GetCallSite get_site_ = GetCallSite::current()
+#define ARGS_GET_SITE_ARG , get_site_
+#define ARGS_GET_TIMER_START(parser, slot) GetTimer get_timer_(parser, slot, get_site_)
+#define ARGS_GET_LOOKUP_DONE() get_timer_.lookup_done()
+#else
+#define ARGS_GET_SITE_PARAM
+#define ARGS_GET_SITE_ARG
+#define ARGS_GET_TIMER_START(parser, slot)
+#define ARGS_GET_LOOKUP_DONE()
+#endif
+
+// a stored value as the declared type. Parsed strings are views into argv,
+// defaults may be owned strings.
+template <typename T>
+T value_as(const AllowedArgTypes & value) {
+    if constexpr (std::is_same_v<T, std::string> || std::is_same_v<T, std::string_view>) {
+      if (const std::string_view *view = std::get_if<std::string_view>(&value)) {
+        return T(*view);
+      }
+      return T(std::get<std::string>(value));
+    } else {
+      return std::get<T>(value);
+    }
+}
+
+// the supplied value of a slot if there is one, else the schema default
+template <typename T> 
+T get(const ArgsParser & parser , const CmdlineArgRef<T> &ref ARGS_GET_SITE_PARAM)  {
+    ARGS_GET_TIMER_START(parser, ref.slot);
+    if(ref.slot >= parser.mSchema->mArguments.size()) {
+      ARGS_THROW(std::runtime_error("invalid args: slot " + std::to_string(ref.slot)));
+    }
+    assert(ref.key_hash == hash_key(arg_key(*parser.mSchema, ref.slot)) &&
+           "CmdlineArgRef used with a parser that has another key in its slot");
+    const Argument & arg = parser.mSchema->mArguments[ref.slot];
+    const ArgValue *supplied = parser.mValues.empty() ? nullptr : find_value(parser, ref.slot);
+    ARGS_GET_LOOKUP_DONE();
+    if(arg.is_store_true()) {
+      if constexpr (std::is_same_v<T, bool>) {
+        return supplied != nullptr && supplied->is_store_passed;
+      }
+    }
+    const AllowedArgTypes *value = supplied != nullptr ? &supplied->value : arg.has_default() ? &arg.value : nullptr;
+    if(value != nullptr) {
+      return value_as<T>(*value);
+    }
+    ARGS_THROW(std::runtime_error("invalid args: " + std::string(arg_key(*parser.mSchema, ref.slot)) + " has no value"));
+}
+
+// get() without exceptions: the value, or NoSlot / NoValue in error
+template <typename T>
+struct GetOutcome {
+  std::optional<T> value;
+  ParseError error{ParseErrc::NoValue, kNoToken, 0, {}};
+
+  bool ok() const { return value.has_value(); }
+  explicit operator bool() const { return ok(); }
+};
+
+template <typename T>
+GetOutcome<T> try_get(const ArgsParser & parser, const CmdlineArgRef<T> & ref) {
+    GetOutcome<T> outcome;
+    outcome.error.index = static_cast<std::uint32_t>(ref.slot);
+    if(ref.slot >= parser.mSchema->mArguments.size()) {
+      outcome.error.code = ParseErrc::NoSlot;
+      return outcome;
+    }
+    const Argument & arg = parser.mSchema->mArguments[ref.slot];
+    const ArgValue *supplied = parser.mValues.empty() ? nullptr : find_value(parser, ref.slot);
+    if(arg.is_store_true()) {
+      if constexpr (std::is_same_v<T, bool>) {
+        outcome.value = supplied != nullptr && supplied->is_store_passed;
+        return outcome;
+      }
+    }
+    const AllowedArgTypes *value = supplied != nullptr ? &supplied->value : arg.has_default() ? &arg.value : nullptr;
+    if(value != nullptr) {
+      outcome.value = value_as<T>(*value);
+    }
+    return outcome;
+}
+
+// ---------------------------------------------------------------------------
+// typed configs
+//
+// A plain struct can stand in for the refs: ARGS_CONFIG lists its members
+// with their keys once, make_config_parser registers them, and parse_config
+// fills a struct directly. Defaults are the member initializers, reading a
+// value is a member load, and a wrong member name or type does not compile.
+//
+//   struct TrainConfig {
+//     int batch_size = 32;
+//     bool verbose = false;
+//     int gpus = 0;
+//   };
+//   ARGS_CONFIG(TrainConfig,
+//               ARGS_OPTIONAL(batch_size, "--batch-size", "Size of each batch"),
+//               ARGS_STORE_TRUE(verbose, "--verbose", "Print verbose logs"),
+//               ARGS_REQUIRED(gpus, "-ll:gpus", "Number of GPUs"));
+//
+//   static const auto parser = make_config_parser<TrainConfig>();
+//   TrainConfig config = parse_config(parser, argc, argv);
+// ---------------------------------------------------------------------------
+
+enum class ConfigFieldKind { Optional, Required, StoreTrue };
+
+template <typename Config, typename T, ConfigFieldKind Kind>
+struct ConfigField {
+  using value_type = T;
+  static constexpr ConfigFieldKind kind = Kind;
+  T Config::*member;
+  std::string_view key;
+  std::string_view description;
+};
+
+template <ConfigFieldKind Kind, typename Config, typename T>
+constexpr ConfigField<Config, T, Kind> config_field(T Config::*member, std::string_view key, std::string_view description) {
+  static_assert(arg_type_index<T> < std::variant_size_v<AllowedArgTypes>, "unsupported config member type");
+  static_assert(!std::is_same_v<T, std::string_view>, "string_view members would outlive the parse, use std::string");
+  static_assert(Kind != ConfigFieldKind::StoreTrue || std::is_same_v<T, bool>, "store_true members must be bool");
+  return ConfigField<Config, T, Kind>{member, key, description};
+}
+
+// compile time check of ARGS_CONFIG, also rejects keys parseKey would reject
+template <typename... Fields>
+constexpr bool config_keys_unique(const std::tuple<Fields...> & fields) {
+  std::array<std::string_view, sizeof...(Fields)> keys = std::apply(
+      [](const auto &... field) { return std::array<std::string_view, sizeof...(Fields)>{parseKeyView(field.key)...}; }, fields);
+  for (std::size_t a = 0; a < keys.size(); a++) {
+    for (std::size_t b = a + 1; b < keys.size(); b++) {
+      if (keys[a] == keys[b]) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+#define ARGS_OPTIONAL(member, key, description) config_field<ConfigFieldKind::Optional>(&Self::member, key, description)
+#define ARGS_REQUIRED(member, key, description) config_field<ConfigFieldKind::Required>(&Self::member, key, description)
+#define ARGS_STORE_TRUE(member, key, description) config_field<ConfigFieldKind::StoreTrue>(&Self::member, key, description)
+
+// must be used in the namespace of Struct, the fields are found through ADL
+#define ARGS_CONFIG(Struct, ...)                                                                        \
+  constexpr auto args_config_fields(const Struct *) {                                                   \
+    using Self = Struct;                                                                                \
+    return std::make_tuple(__VA_ARGS__);                                                                \
+  }                                                                                                     \
+  static_assert(config_keys_unique(args_config_fields(static_cast<const Struct *>(nullptr))),           \
+                #Struct " has two members with the same key")
+
+template <typename Config>
+constexpr auto config_fields() {
+  return args_config_fields(static_cast<const Config *>(nullptr));
+}
+
+// the schema of a config struct. Field I is slot I, more arguments may be
+// registered on parser after the fields.
+template <typename Config>
+struct ConfigParser {
+  ArgsParser parser;
+};
+
+template <typename Config, std::size_t I>
+void register_config_field(ArgsParser & parser, const Config & defaults) {
+  constexpr auto field = std::get<I>(config_fields<Config>());
+  using T = typename decltype(field)::value_type;
+  std::string key(field.key);
+  std::string description(field.description);
+  CmdlineArgRef<T> ref;
+  if constexpr (field.kind == ConfigFieldKind::Required) {
+    ref = add_required_argument<T>(parser, key, std::nullopt, description);
+  } else {
+    ref = add_optional_argument<T>(parser, key, std::optional<T>(defaults.*field.member), description,
+                                   field.kind == ConfigFieldKind::StoreTrue);
+  }
+  assert(ref.slot == I && "config fields must be registered on an empty parser");
+  (void)ref;
+}
+
+template <typename Config, std::size_t... I>
+ConfigParser<Config> make_config_parser(std::index_sequence<I...>) {
+  ConfigParser<Config> result;
+  const Config defaults{};
+  (register_config_field<Config, I>(result.parser, defaults), ...);
+  return result;
+}
+
+template <typename Config>
+ConfigParser<Config> make_config_parser() {
+  constexpr std::size_t n = std::tuple_size_v<decltype(config_fields<Config>())>;
+  return make_config_parser<Config>(std::make_index_sequence<n>{});
+}
+
+template <typename Config, std::size_t I>
+void set_config_field(Config & config, const ArgValue & value) {
+  constexpr auto field = std::get<I>(config_fields<Config>());
+  using T = typename decltype(field)::value_type;
+  if constexpr (field.kind == ConfigFieldKind::StoreTrue) {
+    config.*field.member = value.is_store_passed;
+  } else {
+    config.*field.member = value_as<T>(value.value);
+  }
+}
+
+// starts from the member initializers and writes only the supplied values,
+// one indirect call per value and no key lookups
+template <typename Config, std::size_t... I>
+void fill_config(Config & config, const ArgsParser & result, std::index_sequence<I...>) {
+  using Setter = void (*)(Config &, const ArgValue &);
+  static constexpr Setter setters[] = {&set_config_field<Config, I>...};
+  for (const ArgValue & value : result.mValues) {
+    if (value.slot < sizeof...(I)) {
+      setters[value.slot](config, value);
+    }
+  }
+}
+
+template <typename Config>
+Config parse_config(const ConfigParser<Config> & parser, int argc, const char **argv) {
+  constexpr std::size_t n = std::tuple_size_v<decltype(config_fields<Config>())>;
+  ArgsParser result = parse_args(parser.parser, argc, argv);
+  Config config{};
+  fill_config(config, result, std::make_index_sequence<n>{});
+  return config;
+}
+
+// ---------------------------------------------------------------------------
+// parse snapshots
+//
+// A parse result can be saved as a flat binary blob and loaded back with one
+// mmap, e.g. when every rank of a restarted job parses the same argv again.
+// The blob is keyed by a hash of the schema and of everything parse_args reads
+// (argv with response files expanded, the config file, the environment), so a
+// stale or foreign snapshot is detected and the caller falls back to parsing.
+//
+//   SnapshotHeader
+//   SnapshotValue[num_values]   one per supplied value, sorted by slot
+//   data                        strings ('\0' terminated) and list elements
+//
+// Offsets are relative to the start of the blob, nothing in it is a pointer.
+// ---------------------------------------------------------------------------
+
+constexpr std::uint32_t kSnapshotVersion = 2;
+
+struct SnapshotHeader {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t num_values;
+  std::uint64_t key;
+  std::uint64_t size;     // of the whole blob
+  std::uint64_t checksum; // of everything after the header
+};
+
+struct SnapshotValue {
+  std::uint8_t type_index;
+  std::uint8_t source;
+  std::uint8_t is_store_passed;
+  std::uint8_t reserved;
+  std::uint32_t slot;
+  std::uint64_t payload; // scalar bits, or offset of the string / list data
+  std::uint64_t length;  // bytes of a string, elements of a list
+};
+
+constexpr char kSnapshotMagic[8] = {'A', 'R', 'G', 'S', 'N', 'A', 'P', '\0'};
+
+std::uint64_t hash_combine(std::uint64_t h, std::uint64_t v) {
+  return hash_mix(h ^ (v + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2)));
+}
+
+// for blobs, 8 bytes per step instead of hash_key's byte at a time
+std::uint64_t hash_bytes(const void *data, std::size_t size) {
+  const char *p = static_cast<const char *>(data);
+  std::uint64_t h = hash_mix(size);
+  for (; size >= 8; p += 8, size -= 8) {
+    std::uint64_t word;
+    std::memcpy(&word, p, 8);
+    h = hash_mix(h ^ word) + word;
+  }
+  std::uint64_t tail = 0;
+  std::memcpy(&tail, p, size);
+  return hash_mix(h ^ tail);
+}
+
+// calls f(bytes, element count) with the raw representation of a value:
+// scalars as their object bytes, strings as their characters, lists as their
+// elements
+template <typename F>
+void visit_value_bytes(const AllowedArgTypes & value, F && f) {
+  std::visit([&](const auto & v) {
+    using V = std::decay_t<decltype(v)>;
+    if constexpr (std::is_same_v<V, std::string> || std::is_same_v<V, std::string_view>) {
+      f(std::string_view(v.data(), v.size()), v.size());
+    } else if constexpr (is_list_type<V>::value) {
+      f(std::string_view(reinterpret_cast<const char *>(v.data()), v.size() * sizeof(v[0])), v.size());
+    } else {
+      f(std::string_view(reinterpret_cast<const char *>(&v), sizeof(v)), 1);
+    }
+  }, value);
+}
+
+std::uint64_t schema_hash(const ArgSchema & schema) {
+  std::uint64_t h = hash_key(schema.mConfigFile);
+  h = hash_combine(h, schema.mEnvPrefix.has_value() ? hash_key(*schema.mEnvPrefix) + 1 : 0);
+  h = hash_combine(h, schema.mAllowAbbrev);
+  for (std::size_t slot = 0; slot < schema.mArguments.size(); slot++) {
+    const Argument & arg = schema.mArguments[slot];
+    h = hash_combine(h, hash_key(arg_key(schema, slot)));
+    h = hash_combine(h, arg.type_index | arg.is_store_true() << 8 | arg.is_optional() << 9 | arg.has_default() << 10);
+    if (arg.has_default()) {
+      visit_value_bytes(arg.value, [&](std::string_view bytes, std::size_t) {
+        h = hash_combine(h, hash_key(bytes));
+      });
+    }
+  }
+  // a cached result has to have passed the same constraints
+  for (const ValueCheck & check : schema.mValueChecks) {
+    h = hash_combine(h, check.slot | static_cast<std::uint64_t>(check.kind) << 32);
+    h = hash_combine(h, hash_bytes(&check.lo, sizeof(check.lo)) ^ hash_bytes(&check.hi, sizeof(check.hi)) << 1);
+    for (std::uint32_t i = check.first; check.kind == CheckKind::Choices && i < check.first + check.count; i++) {
+      h = hash_combine(h, hash_key(pool_view(schema.mStrings, schema.mChoices[i])));
+    }
+    if (check.kind == CheckKind::Pattern) {
+      h = hash_combine(h, hash_bytes(schema.mCharSets[check.first].bits.data(), sizeof(CharSet::bits)));
+    }
+  }
+  for (const CrossCheck & check : schema.mCrossChecks) {
+    h = hash_combine(h, hash_key(pool_view(schema.mStrings, check.message)));
+  }
+  return h;
+}
+
+// hashes the raw bytes of a response file and of the files it includes. This
+// does not tokenize: every "@word" that starts a line or follows whitespace is
+// treated as an include, which can only make the key more conservative.
+// open_files are the files being hashed, by device and inode as in
+// expand_response_file, so a file including itself is hashed once.
+std::uint64_t hash_response_file(const std::string & path, std::vector<struct stat> & open_files) {
+  struct stat st;
+  std::shared_ptr<MappedFile> file = try_map_file(path, &st);
+  if (file == nullptr) {
+    return 0; // parse_args reports it
+  }
+  // an include cycle is not followed, parse_args reports it too
+  for (const struct stat & open_st : open_files) {
+    if (open_st.st_dev == st.st_dev && open_st.st_ino == st.st_ino) {
+      return 1;
+    }
+  }
+  open_files.push_back(st);
+  std::uint64_t h = hash_bytes(file->data, file->size);
+  const char *end = file->data + file->size;
+  for (const char *p = file->data; (p = static_cast<const char *>(std::memchr(p, '@', end - p))); p++) {
+    if (p == file->data || is_space(p[-1])) {
+      const char *word_end = p + 1;
+      while (word_end < end && !is_space(*word_end)) {
+        word_end++;
+      }
+      h = hash_combine(h, hash_response_file(std::string(p + 1, word_end), open_files));
+    }
+  }
+  open_files.pop_back();
+  return h;
+}
+
+// hash of the schema and of every input parse_args would read for this argv
+std::uint64_t snapshot_key(const ArgsParser & mArgs, int argc, const char **argv) {
+  const ArgSchema & schema = *mArgs.mSchema;
+  std::uint64_t h = hash_combine(schema_hash(schema), kSnapshotVersion);
+  for (int i = 1; i < argc; i++) {
+    h = hash_combine(h, hash_bytes(argv[i], std::strlen(argv[i])));
+    if (argv[i][0] == '@') {
+      std::vector<struct stat> open_files;
+      h = hash_combine(h, hash_response_file(argv[i] + 1, open_files));
+    }
+  }
+  // summed so the order of environ does not matter
+  std::uint64_t env_hash = 0;
+  for_each_env_entry(schema, [&](std::size_t slot, const char *raw) {
+    env_hash += hash_combine(slot, hash_key(raw));
+  });
+  h = hash_combine(h, env_hash);
+  if (!schema.mConfigFile.empty()) {
+    std::shared_ptr<MappedFile> file = map_file(schema.mConfigFile);
+    h = hash_combine(h, hash_bytes(file->data, file->size));
+  }
+  return h;
+}
+
+std::string serialize_snapshot(const ArgsParser & result, std::uint64_t key) {
+  std::size_t n = result.mValues.size();
+  std::string blob(sizeof(SnapshotHeader) + n * sizeof(SnapshotValue), '\0');
+  std::vector<SnapshotValue> values(n);
+  for (std::size_t i = 0; i < n; i++) {
+    const ArgValue & value = result.mValues[i];
+    std::size_t type_index = result.mSchema->mArguments[value.slot].type_index;
+    SnapshotValue & out = values[i];
+    out.type_index = static_cast<std::uint8_t>(type_index);
+    out.source = static_cast<std::uint8_t>(value.source);
+    out.is_store_passed = value.is_store_passed;
+    out.slot = value.slot;
+    visit_value_bytes(value.value, [&](std::string_view bytes, std::size_t count) {
+      bool scalar = !std::holds_alternative<std::string>(value.value) &&
+                    !std::holds_alternative<std::string_view>(value.value) && !is_list_index(type_index);
+      if (scalar) {
+        std::memcpy(&out.payload, bytes.data(), bytes.size());
+        return;
+      }
+      blob.resize((blob.size() + 7) & ~std::size_t(7));
+      out.payload = blob.size();
+      out.length = count;
+      blob.append(bytes);
+      blob.push_back('\0');
+    });
+  }
+  std::memcpy(&blob[sizeof(SnapshotHeader)], values.data(), n * sizeof(SnapshotValue));
+
+  SnapshotHeader header{};
+  std::memcpy(header.magic, kSnapshotMagic, sizeof(header.magic));
+  header.version = kSnapshotVersion;
+  header.num_values = static_cast<std::uint32_t>(n);
+  header.key = key;
+  header.size = blob.size();
+  header.checksum = hash_bytes(blob.data() + sizeof(SnapshotHeader), blob.size() - sizeof(SnapshotHeader));
+  std::memcpy(&blob[0], &header, sizeof(header));
+  return blob;
+}
+
+// rebuilds the value of one slot. Strings stay views into the mapping,
+// scalars and lists are copied as they are, nothing is parsed.
+template <typename T>
+AllowedArgTypes read_snapshot_value(const MappedFile & file, const SnapshotValue & slot) {
+  if constexpr (std::is_same_v<T, std::string> || std::is_same_v<T, std::string_view>) {
+    return AllowedArgTypes{std::string_view(file.data + slot.payload, slot.length)};
+  } else if constexpr (is_list_type<T>::value) {
+    const auto *first = reinterpret_cast<const typename T::value_type *>(file.data + slot.payload);
+    return AllowedArgTypes{std::in_place_type<T>, first, first + slot.length};
+  } else {
+    T value;
+    std::memcpy(&value, &slot.payload, sizeof(T));
+    return AllowedArgTypes{value};
+  }
+}
+
+template <std::size_t... I>
+AllowedArgTypes read_snapshot_value(const MappedFile & file, const SnapshotValue & slot, std::index_sequence<I...>) {
+  using Reader = AllowedArgTypes (*)(const MappedFile &, const SnapshotValue &);
+  static constexpr Reader readers[] = {&read_snapshot_value<std::variant_alternative_t<I, AllowedArgTypes>>...};
+  return readers[slot.type_index](file, slot);
+}
+
+// nullopt if the blob is corrupt, from another version or was saved under a
+// different key (see snapshot_key). String values point into file.
+std::optional<ArgsParser> load_snapshot(const ArgsParser & mArgs, std::uint64_t key, std::shared_ptr<MappedFile> file) {
+  SnapshotHeader header;
+  if (file->size < sizeof(header)) {
+    return std::nullopt;
+  }
+  std::memcpy(&header, file->data, sizeof(header));
+  std::size_t n = header.num_values;
+  if (std::memcmp(header.magic, kSnapshotMagic, sizeof(header.magic)) != 0 || header.version != kSnapshotVersion ||
+      header.size != file->size || sizeof(header) + n * sizeof(SnapshotValue) > file->size ||
+      header.checksum != hash_bytes(file->data + sizeof(header), file->size - sizeof(header)) ||
+      header.key != key) {
+    return std::nullopt;
+  }
+
+  const ArgSchema & schema = *mArgs.mSchema;
+  ArgsParser result(mArgs.mSchema, std::pmr::get_default_resource());
+  result.mValues.reserve(n);
+  const auto *values = reinterpret_cast<const SnapshotValue *>(file->data + sizeof(header));
+  for (std::size_t i = 0; i < n; i++) {
+    const SnapshotValue & in = values[i];
+    if (in.slot >= schema.mArguments.size() || in.type_index != schema.mArguments[in.slot].type_index) {
+      return std::nullopt;
+    }
+    result.mValues.push_back(ArgValue{in.slot, static_cast<ValueSource>(in.source), in.is_store_passed != 0,
+                                      read_snapshot_value(*file, in, std::make_index_sequence<std::variant_size_v<AllowedArgTypes>>{})});
+  }
+  result.mMappedFiles.push_back(std::move(file));
+  return result;
+}
+
+// same for a snapshot file, nullopt also if it is missing
+std::optional<ArgsParser> load_snapshot(const ArgsParser & mArgs, std::uint64_t key, const std::string & path) {
+  std::shared_ptr<MappedFile> file = try_map_file(path);
+  if (file == nullptr) {
+    return std::nullopt;
+  }
+  return load_snapshot(mArgs, key, std::move(file));
+}
+
+// written to a temporary file and renamed, so readers never see half a snapshot
+bool save_snapshot(const ArgsParser & result, std::uint64_t key, const std::string & path) {
+  std::string blob = serialize_snapshot(result, key);
+  std::string tmp = path + ".tmp" + std::to_string(getpid());
+  int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  bool ok = write(fd, blob.data(), blob.size()) == static_cast<ssize_t>(blob.size());
+  ok = close(fd) == 0 && ok;
+  if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+    unlink(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+// parse_args, but reuse the snapshot at path if it matches and refresh it if not
+// Namespace handlers have to see the flags and pass-through entries are not
+// part of the snapshot, so either one means a plain parse.
+ArgsParser parse_args_cached(const ArgsParser & mArgs, int argc, const char **argv, const std::string & path) {
+  if (!mArgs.mSchema->mNamespaceHandlers.empty()) {
+    return parse_args(mArgs, argc, argv);
+  }
+  std::uint64_t key = snapshot_key(mArgs, argc, argv);
+  if (std::optional<ArgsParser> cached = load_snapshot(mArgs, key, path)) {
+    return std::move(*cached);
+  }
+  ArgsParser result = parse_args(mArgs, argc, argv);
+  if (result.mPassThrough.empty()) {
+    save_snapshot(result, key, path);
+  }
+  return result;
+}
+
+// ---------------------------------------------------------------------------
+// node-local shared snapshots
+//
+// All ranks of a node start with the same argv and config at the same time.
+// parse_args_shared lets the first of them parse and publish the snapshot
+// blob in a POSIX shared memory segment; the others map it and their
+// string values point straight into it. The segment name carries the
+// snapshot key, so a different schema, argv, environment or config file
+// simply finds no segment and parses. Anything that goes wrong on the way
+// (no /dev/shm, a publisher that died, a timeout) ends in a plain parse_args.
+//
+// The publisher writes the blob first and the magic last, readers wait for
+// the magic. A publisher that cannot publish the result writes
+// kSharedDeclinedMagic instead so the others parse right away.
+//
+// The last 8 bytes of a segment count the readers that mapped it. When the
+// number of local ranks is known, the reader that completes the count
+// unlinks the name; the mappings stay valid after that.
+// ---------------------------------------------------------------------------
+
+constexpr char kSharedDeclinedMagic[8] = {'A', 'R', 'G', 'S', 'K', 'I', 'P', '\0'};
+
+std::string shared_segment_name(const std::string & name, std::uint64_t key) {
+  char hex[17];
+  std::snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(key));
+  return "/" + name + "-" + hex;
+}
+
+// the first 8 bytes of a segment, read as the release store that wrote them
+std::uint64_t load_magic_word(const char *data) {
+  return __atomic_load_n(reinterpret_cast<const std::uint64_t *>(data), __ATOMIC_ACQUIRE);
+}
+
+std::uint64_t magic_word(const char (&magic)[8]) {
+  std::uint64_t word;
+  std::memcpy(&word, magic, sizeof(word));
+  return word;
+}
+
+// processes on this node the launcher started, 0 if it does not say
+int local_rank_count() {
+  for (const char *name : {"OMPI_COMM_WORLD_LOCAL_SIZE", "MPI_LOCALNRANKS", "LOCAL_WORLD_SIZE"}) {
+    if (const char *value = std::getenv(name)) {
+      return std::atoi(value);
+    }
+  }
+  return 0;
+}
+
+// bytes of a segment in front of the reader count
+std::size_t shared_blob_capacity(std::size_t segment_size) {
+  return segment_size - sizeof(std::uint64_t);
+}
+
+// fd is a segment just created by this process
+void publish_shared(int fd, const std::string & blob) {
+  std::size_t size = ((std::max(blob.size(), sizeof(SnapshotHeader)) + 7) & ~std::size_t(7)) + sizeof(std::uint64_t);
+  void *data = ftruncate(fd, static_cast<off_t>(size)) == 0
+                   ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+  if (data == MAP_FAILED) {
+    return; // readers time out and parse
+  }
+  char *bytes = static_cast<char *>(data);
+  std::uint64_t magic = magic_word(kSharedDeclinedMagic);
+  if (!blob.empty()) {
+    std::memcpy(bytes + sizeof(magic), blob.data() + sizeof(magic), blob.size() - sizeof(magic));
+    std::memcpy(&magic, blob.data(), sizeof(magic));
+  }
+  __atomic_store_n(reinterpret_cast<std::uint64_t *>(bytes), magic, __ATOMIC_RELEASE);
+  munmap(data, size);
+}
+
+// counts this process as a reader of segment, the last of local_ranks - 1
+// readers unlinks it
+void release_shared(char *data, std::size_t size, const std::string & segment, int local_ranks) {
+  auto *readers = reinterpret_cast<std::uint64_t *>(data + shared_blob_capacity(size));
+  std::uint64_t count = __atomic_add_fetch(readers, 1, __ATOMIC_ACQ_REL);
+  if (local_ranks > 0 && count + 1 == static_cast<std::uint64_t>(local_ranks)) {
+    shm_unlink(segment.c_str());
+  }
+}
+
+// maps a segment another rank is publishing, nullptr if it was declined or
+// did not appear within wait_ms (timed_out)
+std::shared_ptr<MappedFile> map_shared(int fd, const std::string & segment, int local_ranks, int wait_ms,
+                                       bool & timed_out) {
+  timed_out = false;
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(wait_ms);
+  do {
+    struct stat st;
+    if (fstat(fd, &st) == 0 &&
+        static_cast<std::size_t>(st.st_size) >= sizeof(SnapshotHeader) + sizeof(std::uint64_t)) {
+      std::size_t size = static_cast<std::size_t>(st.st_size);
+      void *data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      if (data == MAP_FAILED) {
+        return nullptr;
+      }
+      char *bytes = static_cast<char *>(data);
+      std::uint64_t magic = load_magic_word(bytes);
+      if (magic == magic_word(kSnapshotMagic) || magic == magic_word(kSharedDeclinedMagic)) {
+        release_shared(bytes, size, segment, local_ranks);
+      }
+      if (magic == magic_word(kSnapshotMagic)) {
+        SnapshotHeader header;
+        std::memcpy(&header, bytes, sizeof(header));
+        auto file = std::make_shared<MappedFile>();
+        file->data = bytes;
+        // load_snapshot rejects a header.size that does not fit
+        file->size = std::min<std::size_t>(header.size, shared_blob_capacity(size));
+        file->mapped_size = size;
+        return file;
+      }
+      munmap(data, size);
+      if (magic == magic_word(kSharedDeclinedMagic)) {
+        return nullptr;
+      }
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  } while (std::chrono::steady_clock::now() < deadline);
+  timed_out = true;
+  return nullptr;
+}
+
+// parse_args, shared between the local_ranks processes of a node that use
+// the same name. The last of them to map the segment removes it. With
+// local_ranks 0 the segment stays until unlink_shared_args and a later job
+// with the same inputs reuses it.
+ArgsParser parse_args_shared(const ArgsParser & mArgs, int argc, const char **argv, const std::string & name,
+                             int local_ranks = local_rank_count(), int wait_ms = 10000) {
+  if (!mArgs.mSchema->mNamespaceHandlers.empty()) {
+    return parse_args(mArgs, argc, argv); // handlers have to see the flags
+  }
+  std::uint64_t key = snapshot_key(mArgs, argc, argv);
+  std::string segment = shared_segment_name(name, key);
+
+  int fd = shm_open(segment.c_str(), O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0600);
+  if (fd >= 0) {
+    ParseOutcome outcome = try_parse_args(mArgs, argc, argv);
+    if (!outcome.ok()) {
+      publish_shared(fd, {});
+      shm_unlink(segment.c_str());
+      close(fd);
+      fail_parse(outcome);
+    }
+    ArgsParser & result = outcome.result;
+    // pass-through entries are not part of the snapshot
+    publish_shared(fd, result.mPassThrough.empty() ? serialize_snapshot(result, key) : std::string());
+    close(fd);
+    if (local_ranks == 1) {
+      shm_unlink(segment.c_str()); // nobody else is coming
+    }
+    return std::move(result);
+  }
+
+  fd = errno == EEXIST ? shm_open(segment.c_str(), O_RDWR | O_CLOEXEC, 0) : -1;
+  if (fd >= 0) {
+    bool timed_out = false;
+    std::shared_ptr<MappedFile> file = map_shared(fd, segment, local_ranks, wait_ms, timed_out);
+    close(fd);
+    if (timed_out) {
+      // most likely the publisher died, do not let the next job wait again
+      shm_unlink(segment.c_str());
+    }
+    if (file != nullptr) {
+      if (std::optional<ArgsParser> shared = load_snapshot(mArgs, key, std::move(file))) {
+        return std::move(*shared);
+      }
+    }
+  }
+  return parse_args(mArgs, argc, argv);
+}
+
+// removes the segment parse_args_shared uses for these inputs
+void unlink_shared_args(const ArgsParser & mArgs, int argc, const char **argv, const std::string & name) {
+  shm_unlink(shared_segment_name(name, snapshot_key(mArgs, argc, argv)).c_str());
+}
+
+// ---------------------------------------------------------------------------
+// batch parsing
+//
+// Validates many candidate command lines against one schema, e.g. for a
+// hyperparameter sweep. The schema is only read, so the workers share it
+// without locking. Candidates are handed out in chunks through an atomic
+// counter, and every worker writes only its own result entries.
+// ---------------------------------------------------------------------------
+
+// one ParseOutcome per candidate, in order. Failures keep their ParseErrors,
+// error_message() formats them when a caller wants the text.
+std::vector<ParseOutcome> parse_args_batch(const ArgsParser & mArgs, const ArgvView *candidates, std::size_t count,
+                                           unsigned num_threads = std::thread::hardware_concurrency()) {
+  // ParseOutcome has no empty state, the workers fill these in place
+  std::vector<std::optional<ParseOutcome>> outcomes(count);
+  constexpr std::size_t kChunk = 64;
+  std::atomic<std::size_t> next{0};
+  auto worker = [&] {
+    for (std::size_t begin; (begin = next.fetch_add(kChunk, std::memory_order_relaxed)) < count;) {
+      std::size_t end = std::min(begin + kChunk, count);
+      for (std::size_t i = begin; i < end; i++) {
+        outcomes[i].emplace(try_parse_args(mArgs, candidates[i].argc, candidates[i].argv));
+      }
+    }
+  };
+
+  num_threads = std::max(1u, std::min<unsigned>(num_threads, (count + kChunk - 1) / kChunk));
+  std::vector<std::thread> threads;
+  for (unsigned t = 1; t < num_threads; t++) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (std::thread & thread : threads) {
+    thread.join();
+  }
+  std::vector<ParseOutcome> results;
+  results.reserve(count);
+  for (std::optional<ParseOutcome> & outcome : outcomes) {
+    results.push_back(std::move(*outcome));
+  }
+  return results;
+}
+
+std::vector<ParseOutcome> parse_args_batch(const ArgsParser & mArgs, const std::vector<ArgvView> & candidates,
+                                           unsigned num_threads = std::thread::hardware_concurrency()) {
+  return parse_args_batch(mArgs, candidates.data(), candidates.size(), num_threads);
+}
+
+// ---------------------------------------------------------------------------
+// live configs
+//
+// LiveConfig holds the current parse result of a long running process and
+// parses again when its config file changes. Readers never lock: a read bumps
+// a per-thread reader counter, loads the result pointer and drops the counter
+// again. A reload publishes the new result with one pointer swap, waits until
+// no reader can still hold the old one (two counter generations, flipped in
+// turn as in userspace RCU) and only then frees it. A reload that does not
+// parse keeps the current result.
+//
+// The command line still overrides the file, so only keys that were not
+// passed on the command line change at runtime.
+// ---------------------------------------------------------------------------
+
+// replaces string values that point into response or config files by owned
+// copies, so the result no longer depends on the files staying unchanged
+void own_file_values(ArgsParser & result) {
+  for (ArgValue & value : result.mValues) {
+    const std::string_view *view = std::get_if<std::string_view>(&value.value);
+    if (view == nullptr) {
+      continue;
+    }
+    for (const std::shared_ptr<MappedFile> & file : result.mMappedFiles) {
+      if (view->data() >= file->data && view->data() < file->data + file->mapped_size) {
+        value.value = AllowedArgTypes{std::string(*view)};
+        break;
+      }
+    }
+  }
+  result.mMappedFiles.clear();
+}
+
+class LiveConfig {
+public:
+  // parses once and throws like parse_args. argv must outlive the LiveConfig.
+  LiveConfig(const ArgsParser & parser, int argc, const char **argv)
+      : mParser(parser), mArgc(argc), mArgv(argv), mCurrent(parse(parser, argc, argv)) {}
+
+  LiveConfig(const LiveConfig &) = delete;
+  LiveConfig & operator=(const LiveConfig &) = delete;
+
+  // no reader may be inside read() any more
+  ~LiveConfig() {
+    if (mWatcher.joinable()) {
+      char stop = 0;
+      (void)!write(mStopPipe[1], &stop, 1);
+      mWatcher.join();
+      close(mStopPipe[0]);
+      close(mStopPipe[1]);
+    }
+    delete mCurrent.load();
+  }
+
+  // f(const ArgsParser &) on the current result, which stays alive until f
+  // returns. Never blocks, also not while a reload is in progress.
+  template <typename F>
+  decltype(auto) read(F && f) const {
+    std::atomic<std::uint64_t> & readers = mReaders[mPhase.load() & 1][reader_slot()].count;
+    readers.fetch_add(1);
+    struct Leave {
+      std::atomic<std::uint64_t> & readers;
+      ~Leave() { readers.fetch_sub(1); }
+    } leave{readers};
+    return f(*mCurrent.load());
+  }
+
+  // parses again now. On failure the current result stays and last_error()
+  // says why.
+  bool reload() {
+    std::lock_guard<std::mutex> lock(mWriteMutex);
+    ParseOutcome outcome = try_parse_args(mParser, mArgc, mArgv);
+    if (!outcome.ok()) {
+      mLastError = error_message(outcome);
+      return false;
+    }
+    own_file_values(outcome.result);
+    const ArgsParser *old = mCurrent.exchange(new ArgsParser(std::move(outcome.result)));
+    wait_for_readers();
+    delete old;
+    mLastError.clear();
+    mGeneration++;
+    return true;
+  }
+
+  // reloads from a background thread whenever the config file is written or
+  // replaced; on_reload(ok, error) is called after every attempt
+  void watch(std::function<void(bool ok, const std::string & error)> on_reload = {}) {
+    const std::string & path = mParser.mSchema->mConfigFile;
+    if (path.empty() || mWatcher.joinable()) {
+      ARGS_THROW(std::runtime_error(path.empty() ? "live config: no config file to watch" : "live config: already watching"));
+    }
+    // watch the directory, editors usually replace the file by a rename
+    std::size_t split = path.rfind('/');
+    std::string dir = split == std::string::npos ? "." : path.substr(0, split + 1);
+    std::string name = split == std::string::npos ? path : path.substr(split + 1);
+    int fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (fd < 0 || inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0 || pipe(mStopPipe) != 0) {
+      if (fd >= 0) {
+        close(fd);
+      }
+      ARGS_THROW(std::runtime_error("live config: cannot watch " + path));
+    }
+    mWatcher = std::thread([this, fd, name, on_reload = std::move(on_reload)] {
+      alignas(inotify_event) char buffer[4096];
+      pollfd fds[2] = {{fd, POLLIN, 0}, {mStopPipe[0], POLLIN, 0}};
+      while (poll(fds, 2, -1) >= 0 && (fds[1].revents & POLLIN) == 0) {
+        // one reload for a burst of events, e.g. truncate + write + close
+        bool changed = false;
+        for (ssize_t n; (n = ::read(fd, buffer, sizeof(buffer))) > 0;) {
+          for (char *p = buffer; p < buffer + n;) {
+            const auto *event = reinterpret_cast<const inotify_event *>(p);
+            changed |= event->len > 0 && name == event->name;
+            p += sizeof(inotify_event) + event->len;
+          }
+        }
+        if (changed) {
+          bool ok = reload();
+          if (on_reload) {
+            on_reload(ok, last_error());
+          }
+        }
+      }
+      close(fd);
+    });
+  }
+
+  std::string last_error() const {
+    std::lock_guard<std::mutex> lock(mWriteMutex);
+    return mLastError;
+  }
+
+  // number of successful reloads
+  std::uint64_t generation() const {
+    std::lock_guard<std::mutex> lock(mWriteMutex);
+    return mGeneration;
+  }
+
+private:
+  static constexpr std::size_t kReaderSlots = 16;
+
+  struct alignas(64) ReaderCount {
+    std::atomic<std::uint64_t> count{0};
+  };
+
+  static const ArgsParser *parse(const ArgsParser & parser, int argc, const char **argv) {
+    ArgsParser result = parse_args(parser, argc, argv);
+    own_file_values(result);
+    return new ArgsParser(std::move(result));
+  }
+
+  // threads spread over the counters so readers rarely share a cache line
+  static std::size_t reader_slot() {
+    static std::atomic<std::size_t> next{0};
+    thread_local std::size_t slot = next.fetch_add(1, std::memory_order_relaxed) % kReaderSlots;
+    return slot;
+  }
+
+  // a reader that may hold the old result counted itself before loading it,
+  // in whichever generation was current then. New readers go to the other
+  // generation after a flip, so each wait ends even under constant reads.
+  void wait_for_readers() {
+    for (int flip = 0; flip < 2; flip++) {
+      std::uint64_t old_phase = mPhase.fetch_add(1) & 1;
+      for (const ReaderCount & slot : mReaders[old_phase]) {
+        while (slot.count.load() != 0) {
+          std::this_thread::yield();
+        }
+      }
+    }
+  }
+
+  ArgsParser mParser; // shares the schema, holds no values
+  int mArgc;
+  const char **mArgv;
+  std::atomic<const ArgsParser *> mCurrent;
+  std::atomic<std::uint64_t> mPhase{0};
+  mutable ReaderCount mReaders[2][kReaderSlots];
+  mutable std::mutex mWriteMutex; // one reload at a time
+  std::string mLastError;
+  std::uint64_t mGeneration = 0;
+  std::thread mWatcher;
+  int mStopPipe[2] = {-1, -1};
+};
+
+// a value of the current result. Views are not allowed, they would point into
+// a result a reload may free.
+template <typename T>
+T get(const LiveConfig & config, const CmdlineArgRef<T> & ref ARGS_GET_SITE_PARAM) {
+  static_assert(!std::is_same_v<T, std::string_view>, "use std::string, a view can outlive the live result");
+  // the profiled call site is the caller's, not this line
+  return config.read([&](const ArgsParser & result) { return get(result, ref ARGS_GET_SITE_ARG); });
+}
+
+// ---------------------------------------------------------------------------
+// compile-time schema
+//
+// For launchers with a fixed flag set. The keys are hashed at compile time into
+// a perfect hash table (hash and displace): every key owns exactly one slot, so
+// a lookup is one hash, one displacement load and one key compare. Declaring the
+// same key twice fails to compile, and parse_args never touches the heap unless
+// it has to build an error message.
+// ---------------------------------------------------------------------------
+
+struct StaticArgSpec {
+  std::string_view key;           // already normalized by parseKeyView
+  std::string_view default_value; // text form, empty if there is no default
+  bool is_store_true = false;
+  bool is_optional = true;
+};
+
+constexpr StaticArgSpec static_optional(std::string_view key, std::string_view default_value = {}) {
+  return StaticArgSpec{parseKeyView(key), default_value, false, true};
+}
+
+constexpr StaticArgSpec static_required(std::string_view key) {
+  return StaticArgSpec{parseKeyView(key), {}, false, false};
+}
+
+// a switch that was not passed reads as false
+constexpr StaticArgSpec static_store_true(std::string_view key) {
+  return StaticArgSpec{parseKeyView(key), "false", true, true};
+}
+
+constexpr std::size_t static_bucket_count(std::size_t n) {
+  std::size_t b = 1;
+  while (b < n) {
+    b <<= 1;
+  }
+  return b;
+}
+
+template <std::size_t N>
+struct StaticSchema {
+  static constexpr std::size_t kBuckets = static_bucket_count(N);
+  static constexpr std::size_t kSlots = 2 * kBuckets;
+
+  std::array<StaticArgSpec, N> specs{};
+  std::array<std::uint32_t, kBuckets> displacement{};
+  std::array<std::int32_t, kSlots> table{};
+
+  static constexpr std::size_t bucket_of(std::uint64_t h) {
+    return (h >> 32) & (kBuckets - 1);
+  }
+
+  static constexpr std::size_t slot_of(std::uint64_t h, std::uint32_t d) {
+    return hash_mix(h ^ (d * 0x9e3779b97f4a7c15ull)) & (kSlots - 1);
+  }
+
+  // index into specs, or -1 if the key is not declared
+  constexpr int find(std::string_view key) const {
+    std::uint64_t h = hash_key(key);
+    std::int32_t idx = table[slot_of(h, displacement[bucket_of(h)])];
+    if (idx >= 0 && specs[idx].key == key) {
+      return idx;
+    }
+    return -1;
+  }
+
+  constexpr std::size_t index_of(std::string_view flag) const {
+    int idx = find(parseKeyView(flag));
+    if (idx < 0) {
+      ARGS_THROW(std::runtime_error("invalid args: " + std::string(flag) + " does not exist"));
+    }
+    return static_cast<std::size_t>(idx);
+  }
+};
+
+template <std::size_t N>
+constexpr StaticSchema<N> make_static_schema(const StaticArgSpec (&specs)[N]) {
+  using Schema = StaticSchema<N>;
+  Schema schema{};
+  std::array<std::uint64_t, N> hashes{};
+  for (std::size_t i = 0; i < N; i++) {
+    for (std::size_t j = 0; j < i; j++) {
+      if (specs[i].key == specs[j].key) {
+        ARGS_THROW(std::logic_error("static schema: duplicate key")); // duplicate key, see the specs list
+      }
+    }
+    schema.specs[i] = specs[i];
+    hashes[i] = hash_key(specs[i].key);
+  }
+
+  // group keys by first level bucket (counting sort)
+  std::array<std::size_t, Schema::kBuckets + 1> start{};
+  for (std::size_t i = 0; i < N; i++) {
+    start[Schema::bucket_of(hashes[i]) + 1]++;
+  }
+  for (std::size_t b = 0; b < Schema::kBuckets; b++) {
+    start[b + 1] += start[b];
+  }
+  std::array<std::size_t, N> members{};
+  std::array<std::size_t, Schema::kBuckets> fill{};
+  for (std::size_t i = 0; i < N; i++) {
+    std::size_t b = Schema::bucket_of(hashes[i]);
+    members[start[b] + fill[b]++] = i;
+  }
+
+  // place the biggest buckets first, they are the hardest to fit
+  std::array<std::size_t, Schema::kBuckets> order{};
+  for (std::size_t b = 0; b < Schema::kBuckets; b++) {
+    order[b] = b;
+  }
+  for (std::size_t i = 0; i < Schema::kBuckets; i++) {
+    for (std::size_t j = i + 1; j < Schema::kBuckets; j++) {
+      if (start[order[j] + 1] - start[order[j]] > start[order[i] + 1] - start[order[i]]) {
+        std::size_t tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+      }
+    }
+  }
+
+  for (std::size_t s = 0; s < Schema::kSlots; s++) {
+    schema.table[s] = -1;
+  }
+  for (std::size_t b : order) {
+    std::size_t first = start[b];
+    std::size_t last = start[b + 1];
+    if (first == last) {
+      break;
+    }
+    for (std::uint32_t d = 1;; d++) {
+      bool fits = true;
+      for (std::size_t m = first; m < last && fits; m++) {
+        std::size_t slot = Schema::slot_of(hashes[members[m]], d);
+        if (schema.table[slot] >= 0) {
+          fits = false;
+        }
+        for (std::size_t k = first; k < m && fits; k++) {
+          fits = Schema::slot_of(hashes[members[k]], d) != slot;
+        }
+      }
+      if (fits) {
+        schema.displacement[b] = d;
+        for (std::size_t m = first; m < last; m++) {
+          schema.table[Schema::slot_of(hashes[members[m]], d)] = static_cast<std::int32_t>(members[m]);
+        }
+        break;
+      }
+    }
+  }
+  return schema;
+}
+
+template <std::size_t N>
+struct StaticParseResult {
+  std::array<std::string_view, N> values{};
+  std::array<bool, N> passed{};
+};
+
+template <typename T>
+struct StaticArgRef {
+  std::size_t index;
+  std::string_view key; // for error messages
+};
+
+template <typename T, std::size_t N>
+constexpr StaticArgRef<T> static_ref(const StaticSchema<N> & schema, std::string_view flag) {
+  std::size_t index = schema.index_of(flag);
+  return StaticArgRef<T>{index, schema.specs[index].key};
+}
+
+template <std::size_t N>
+StaticParseResult<N> parse_args(const StaticSchema<N> & schema, int argc, const char **argv) {
+    StaticParseResult<N> result;
+    for (std::size_t i = 0; i < N; i++) {
+      result.values[i] = schema.specs[i].default_value;
+    }
+
+    int i = 1;
+    while (i < argc) {
+        std::string_view key = parseKeyView(argv[i]);
+        if (key == "help" || key == "-h") {
+            exit(1);
+        }
+        int idx = schema.find(key);
+        if (idx < 0) {
+            ARGS_THROW(std::runtime_error("invalid args: " + std::string(key) + " does not exist"));
+        }
+
+        if (schema.specs[idx].is_store_true) {
+            result.values[idx] = "true";
+            result.passed[idx] = true;
+            i++;
+            continue;
+        }
+
+        if (i + 1 < argc && argv[i + 1][0] != '-') {
+            result.values[idx] = argv[i + 1];
+            result.passed[idx] = true;
+            i += 2;
+        } else {
+            ARGS_THROW(std::runtime_error("required args: " + std::string(key) + " needs a value"));
+        }
+    }
+
+    std::string missing_args;
+    for (std::size_t k = 0; k < N; k++) {
+        if (!schema.specs[k].is_optional && !result.passed[k]) {
+            missing_args += std::string(schema.specs[k].key) + "  ";
+        }
+    }
+    if (!missing_args.empty()) {
+        ARGS_THROW(std::runtime_error("some required args are not passed: " + missing_args));
+    }
+    return result;
+}
+
+template <typename T, std::size_t N>
+T get(const StaticParseResult<N> & result, StaticArgRef<T> ref) {
+    if (!result.passed[ref.index] && result.values[ref.index].empty()) {
+        ARGS_THROW(std::runtime_error("invalid args: " + std::string(ref.key) + " has no value"));
+    }
+    T value{};
+    if (!convert(result.values[ref.index], value)) {
+        ARGS_THROW(std::runtime_error("invalid args: '" + std::string(result.values[ref.index]) + "' is not a valid " +
+                                      type_name(arg_type_index<T>)));
+    }
+    return value;
+}
+
+#ifdef BENCH
+// micro benchmarks, build with
+//   g++ -std=c++17 -O2 -DBENCH parse3.cc -o bench -pthread && ./bench [name]
+#include <malloc.h>
+#include <new>
+
+static volatile std::size_t bench_sink;
+
+// every heap allocation of the bench binary goes through here so the suite
+// can report allocations per parse and live heap bytes
+static std::atomic<std::size_t> bench_allocations{0};
+static std::atomic<std::size_t> bench_live_bytes{0};
+
+void *bench_counted(void *p) {
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  bench_allocations.fetch_add(1, std::memory_order_relaxed);
+  bench_live_bytes.fetch_add(malloc_usable_size(p), std::memory_order_relaxed);
+  return p;
+}
+
+void bench_release(void *p) {
+  if (p != nullptr) {
+    bench_live_bytes.fetch_sub(malloc_usable_size(p), std::memory_order_relaxed);
+    std::free(p);
+  }
+}
+
+// noinline on both sides: inlined into a caller, malloc/free would show
+// through and gcc warns about mismatched new/delete
+__attribute__((noinline)) void *operator new(std::size_t size) {
+  return bench_counted(std::malloc(size == 0 ? 1 : size));
+}
+
+__attribute__((noinline)) void *operator new(std::size_t size, std::align_val_t align) {
+  std::size_t a = static_cast<std::size_t>(align);
+  return bench_counted(std::aligned_alloc(a, (std::max<std::size_t>(size, 1) + a - 1) / a * a));
+}
 
-//currently we only support "--xx" or "-x"
-std::string parseKey(const std::string & arg) {
-    if (arg.substr(0, 2) == "--") {
-      return arg.substr(2);
-    } else if(arg.substr(0, 1) == "-") {
-      return arg;
-    }
-     throw std::runtime_error("parse invalid args: " + arg);
+__attribute__((noinline)) void operator delete(void *p) noexcept {
+  bench_release(p);
+}
+
+__attribute__((noinline)) void operator delete(void *p, std::size_t) noexcept {
+  bench_release(p);
+}
+
+__attribute__((noinline)) void operator delete(void *p, std::align_val_t) noexcept {
+  bench_release(p);
+}
+
+__attribute__((noinline)) void operator delete(void *p, std::size_t, std::align_val_t) noexcept {
+  bench_release(p);
+}
+
+template <typename F>
+double bench_ns_per_op(F && f, int iters) {
+  for (int i = 0; i < iters / 10; i++) {
+    f();
+  }
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iters; i++) {
+    f();
   }
+  auto stop = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(stop - start).count() / iters;
+}
 
-struct Argument {
-    std::optional<std::string> value;  // Change value type to optional<string>
-    std::string description;
-    bool default_value = false;
-    bool is_store_true = false; // Add a new field to indicate whether the argument is store_true
-    bool is_store_passed = false; // Add a new field to indicate whether the argument is passed
-    bool is_optional = false;
-};
+// the runtime ArgsParser against the compile-time perfect hash schema, same
+// 16 launcher flags and the same argv
+void bench_static_schema() {
+  constexpr auto kSchema = make_static_schema({
+      static_optional("--batch-size", "32"),
+      static_optional("--learning-rate", "0.001"),
+      static_optional("--epochs", "1"),
+      static_optional("--seed", "0"),
+      static_optional("--num-layers", "12"),
+      static_optional("--hidden-size", "1024"),
+      static_optional("--weight-decay", "0"),
+      static_optional("--warmup-steps", "0"),
+      static_optional("--fusion", "1"),
+      static_store_true("--verbose"),
+      static_required("-ll:gpus"),
+      static_optional("-ll:cpus", "1"),
+      static_optional("-ll:fsize", "1024"),
+      static_optional("-ll:zsize", "0"),
+      static_optional("-ll:util", "1"),
+      static_optional("-lg:prof", "0"),
+  });
+  constexpr auto batch_size_ref = static_ref<int>(kSchema, "--batch-size");
+  constexpr auto ll_gpus_ref = static_ref<int>(kSchema, "-ll:gpus");
 
-struct ArgsParser {
-  std::unordered_map<std::string, Argument> mArguments;
-  int num_required_args = 0;
-  int pass_required_args = 0; 
-};
+  ArgsParser args;
+  auto batch_size_map_ref = add_optional_argument(args, "--batch-size", std::optional<int>(32), "Size of each batch during training");
+  add_optional_argument(args, "--learning-rate", std::optional<float>(0.001), "Learning rate for the optimizer");
+  add_optional_argument(args, "--epochs", std::optional<int>(1), "Number of epochs for training");
+  add_optional_argument(args, "--seed", std::optional<int>(0), "Random seed");
+  add_optional_argument(args, "--num-layers", std::optional<int>(12), "Number of layers");
+  add_optional_argument(args, "--hidden-size", std::optional<int>(1024), "Hidden size");
+  add_optional_argument(args, "--weight-decay", std::optional<float>(0), "Weight decay");
+  add_optional_argument(args, "--warmup-steps", std::optional<int>(0), "Warmup steps");
+  add_optional_argument(args, "--fusion", std::optional<bool>(true), "Whether to use fusion or not");
+  add_optional_argument(args, "--verbose", std::optional<bool>(false), "Whether to print verbose logs", true);
+  auto ll_gpus_map_ref = add_required_argument<int>(args, "-ll:gpus", std::nullopt, "Number of GPUs to be used for training");
+  add_optional_argument(args, "-ll:cpus", std::optional<int>(1), "Number of CPUs");
+  add_optional_argument(args, "-ll:fsize", std::optional<int>(1024), "Framebuffer memory per GPU in MB");
+  add_optional_argument(args, "-ll:zsize", std::optional<int>(0), "Zero-copy memory in MB");
+  add_optional_argument(args, "-ll:util", std::optional<int>(1), "Utility processors");
+  add_optional_argument(args, "-lg:prof", std::optional<int>(0), "Profiling nodes");
 
-//default_value is std::nullopt 
-// template <typename T>
-//   CmdlineArgRef<T> add_required_argument(ArgsParser & parser, const std::string & key, const std::optional<T> & default_value,
-//                          const std::string &description, bool is_store_true = false) {
-//     std::string parse_key = parseKey(key);
-//     parser.requeiredArguments[parse_key].description = description;
-//     if(default_value.has_value()) {  // Use has_value() to check if there's a value
-//         parser.requeiredArguments[parse_key].value = std::to_string(default_value.value());  // Convert the value to string
-//         parser.requeiredArguments[parse_key].default_value = true;
-//         parser.requeiredArguments[parse_key].is_store_true = is_store_true;
-//         return CmdlineArgRef<T>{parse_key, default_value.value()};
-//     } 
-//     return CmdlineArgRef<T>{parse_key, T{}};
-//   }
+  const char *test_argv[] = {"program_name", "--batch-size", "100", "--learning-rate", "0.03",
+                             "-ll:gpus", "8", "-ll:fsize", "14000", "-ll:zsize", "2000",
+                             "--num-layers", "24", "--verbose"};
+  constexpr int test_argc = sizeof(test_argv) / sizeof(test_argv[0]);
+  constexpr int iters = 200000;
 
+  double map_ns = bench_ns_per_op([&] {
+    ArgsParser result = parse_args(args, test_argc, test_argv);
+    bench_sink = get(result, batch_size_map_ref) + get(result, ll_gpus_map_ref);
+  }, iters);
+  double static_ns = bench_ns_per_op([&] {
+    auto result = parse_args(kSchema, test_argc, test_argv);
+    bench_sink = get(result, batch_size_ref) + get(result, ll_gpus_ref);
+  }, iters);
 
-// template <typename T>
-//   CmdlineArgRef<T> add_optional_argument(ArgsParser & parser, const std::string & key, const std::optional<T> & default_value,
-//                          const std::string &description, bool is_store_true = false) {
-//     std::string parse_key = parseKey(key);
-//     parser.optionalArguments[parse_key].description = description;
-//     parser.optionalArguments[parse_key].is_store_true = is_store_true;
-//     parser.num_optional_args++;
-//     return CmdlineArgRef<T>{parse_key, T{}};
-//   }
+  std::cout << "static_schema: 16 keys, " << (test_argc - 1) << " argv tokens" << std::endl;
+  std::cout << "  ArgsParser (runtime index) " << map_ns << " ns/parse" << std::endl;
+  std::cout << "  StaticSchema (perfect hash) " << static_ns << " ns/parse" << std::endl;
+}
 
-//default_value is std::nullopt 
-template <typename T>
-  CmdlineArgRef<T> add_required_argument(ArgsParser & parser, const std::string & key, const std::optional<T> & default_value,
-                         const std::string &description, bool is_store_true = false) {
-    std::string parse_key = parseKey(key);
-    parser.mArguments[parse_key].description = description;
-    parser.mArguments[parse_key].is_store_true = is_store_true;
-    parser.num_required_args++;
-    std::cout<<"add_required_argument, parser.num_required_args:"<<parser.num_required_args<<std::endl;
-    parser.mArguments[parse_key].is_optional = false;
-    return CmdlineArgRef<T>{parse_key, T{}};
+// the std::stoi / std::stof conversions parse_args used before from_chars
+int legacy_convert_int(std::string const &s) {
+  return std::stoi(s);
+}
+
+float legacy_convert_float(std::string const &s) {
+  return std::stof(s);
+}
+
+void bench_convert() {
+  const std::vector<std::string> ints = {"1", "32", "100", "1024", "65536", "-7", "2147483647", "14000"};
+  const std::vector<std::string> floats = {"0.001", "0.03", "1e-4", "3.14159", "-2.5", "100", "6.02e23", "0.9"};
+  constexpr int iters = 200000;
+
+  double stoi_ns = bench_ns_per_op([&] {
+    std::size_t acc = 0; // unsigned, the sum wraps instead of overflowing
+    for (const std::string &s : ints) {
+      acc += static_cast<std::size_t>(legacy_convert_int(s));
+    }
+    bench_sink = acc;
+  }, iters) / ints.size();
+  double from_chars_int_ns = bench_ns_per_op([&] {
+    std::size_t acc = 0;
+    for (const std::string &s : ints) {
+      int v = 0;
+      convert(std::string_view(s), v);
+      acc += static_cast<std::size_t>(v);
+    }
+    bench_sink = acc;
+  }, iters) / ints.size();
+  double stof_ns = bench_ns_per_op([&] {
+    float acc = 0;
+    for (const std::string &s : floats) {
+      acc += legacy_convert_float(s);
+    }
+    bench_sink = acc != 0; // 6.02e23 does not fit a size_t
+  }, iters) / floats.size();
+  double from_chars_float_ns = bench_ns_per_op([&] {
+    float acc = 0;
+    for (const std::string &s : floats) {
+      float v = 0;
+      convert(std::string_view(s), v);
+      acc += v;
+    }
+    bench_sink = acc != 0; // 6.02e23 does not fit a size_t
+  }, iters) / floats.size();
+  // the error path: stoi has to throw, from_chars just returns false
+  double stoi_error_ns = bench_ns_per_op([&] {
+    try {
+      bench_sink = legacy_convert_int("abc");
+    } catch (const std::invalid_argument &) {
+      bench_sink = 0;
+    }
+  }, iters / 10);
+  double from_chars_error_ns = bench_ns_per_op([&] {
+    int v = 0;
+    bench_sink = convert(std::string_view("abc"), v);
+  }, iters / 10);
+
+  std::cout << "convert: ns per token" << std::endl;
+  std::cout << "  int    std::stoi " << stoi_ns << "  from_chars " << from_chars_int_ns << std::endl;
+  std::cout << "  float  std::stof " << stof_ns << "  from_chars " << from_chars_float_ns << std::endl;
+  std::cout << "  error  std::stoi " << stoi_error_ns << "  from_chars " << from_chars_error_ns << std::endl;
+}
+
+// what callers did before list arguments existed: split the string and stoi
+// every element
+std::vector<int> legacy_split_ints(const std::string &s) {
+  std::vector<int> out;
+  std::size_t begin = 0;
+  while (true) {
+    std::size_t end = s.find(',', begin);
+    out.push_back(std::stoi(s.substr(begin, end - begin)));
+    if (end == std::string::npos) {
+      return out;
+    }
+    begin = end + 1;
   }
+}
 
+void bench_list() {
+  std::string layers;
+  for (int i = 0; i < 50000; i++) {
+    layers += (i ? "," : "") + std::to_string(1024 + i % 4096);
+  }
+  constexpr int iters = 200;
 
-template <typename T>
-  CmdlineArgRef<T> add_optional_argument(ArgsParser & parser, const std::string & key, const std::optional<T> & default_value,
-                         const std::string &description, bool is_store_true = false) {
-    std::string parse_key = parseKey(key);
-    parser.mArguments[parse_key].description = description;
-    if(default_value.has_value()) {  // Use has_value() to check if there's a value
-        parser.mArguments[parse_key].value = std::to_string(default_value.value());  // Convert the value to string
-        parser.mArguments[parse_key].default_value = true;
-        parser.mArguments[parse_key].is_store_true = is_store_true;
-        parser.mArguments[parse_key].is_optional = true;
-        return CmdlineArgRef<T>{parse_key, default_value.value()};
-    } 
-    return CmdlineArgRef<T>{parse_key, T{}};
+  double legacy_ns = bench_ns_per_op([&] {
+    bench_sink = legacy_split_ints(layers).size();
+  }, iters);
+  double list_ns = bench_ns_per_op([&] {
+    std::vector<int> out;
+    parse_list(layers, out);
+    bench_sink = out.size();
+  }, iters);
+
+  std::cout << "list: 50000 ints, " << layers.size() << " bytes" << std::endl;
+  std::cout << "  find + substr + stoi     " << legacy_ns / 1000 << " us" << std::endl;
+  std::cout << "  parse_list (SSE2 split)  " << list_ns / 1000 << " us" << std::endl;
+}
+
+// 2000 flags in a response file: parse vs loading the saved snapshot
+void bench_snapshot() {
+  ArgsParser args;
+  std::string rsp;
+  for (int i = 0; i < 2000; i++) {
+    std::string flag = "--flag-" + std::to_string(i);
+    if (i % 2 == 0) {
+      add_optional_argument(args, flag, std::optional<int>(0), "an int flag");
+      rsp += flag + " " + std::to_string(i * 31) + "\n";
+    } else {
+      add_optional_argument(args, flag, std::optional<double>(0), "a double flag");
+      rsp += flag + " " + std::to_string(i * 0.001) + "\n";
+    }
   }
+  std::string rsp_path = "/tmp/bench_snapshot.rsp";
+  std::string snapshot_path = "/tmp/bench_snapshot.bin";
+  std::string arg = "@" + rsp_path;
+  FILE *f = fopen(rsp_path.c_str(), "w");
+  fwrite(rsp.data(), 1, rsp.size(), f);
+  fclose(f);
+  const char *test_argv[] = {"program_name", arg.c_str()};
+  parse_args_cached(args, 2, test_argv, snapshot_path);
+  constexpr int iters = 200;
 
+  double parse_ns = bench_ns_per_op([&] {
+    bench_sink = parse_args(args, 2, test_argv).mValues.size();
+  }, iters);
+  double load_ns = bench_ns_per_op([&] {
+    bench_sink = parse_args_cached(args, 2, test_argv, snapshot_path).mValues.size();
+  }, iters);
 
-template <typename T>
-  T convert(std::string const &s) ;
+  std::cout << "snapshot: 2000 flags from a response file" << std::endl;
+  std::cout << "  parse_args         " << parse_ns / 1000 << " us" << std::endl;
+  std::cout << "  parse_args_cached  " << load_ns / 1000 << " us" << std::endl;
+  unlink(rsp_path.c_str());
+  unlink(snapshot_path.c_str());
+}
 
-template <>
-int convert<int>(std::string const &s)  {
-  return std::stoi(s);
+// 20000 sweep candidates, 10% of them invalid, from 1 to 64 threads
+void bench_batch() {
+  ArgsParser args;
+  add_optional_argument(args, "--batch-size", std::optional<int>(32), "Size of each batch during training");
+  add_optional_argument(args, "--learning-rate", std::optional<float>(0.001), "Learning rate for the optimizer");
+  add_optional_argument(args, "--weight-decay", std::optional<float>(0), "Weight decay");
+  add_optional_argument(args, "--layers", std::optional<std::vector<int>>(std::vector<int>{1024}), "Width of each layer");
+  add_required_argument<int>(args, "-ll:gpus", std::nullopt, "Number of GPUs to be used for training");
+  for (int i = 0; i < 64; i++) {
+    add_optional_argument(args, "--extra-" + std::to_string(i), std::optional<int>(0), "padding");
+  }
+
+  constexpr std::size_t num_candidates = 20000;
+  std::vector<std::vector<std::string>> storage(num_candidates);
+  std::vector<std::vector<const char *>> pointers(num_candidates);
+  std::vector<ArgvView> candidates(num_candidates);
+  for (std::size_t c = 0; c < num_candidates; c++) {
+    storage[c] = {"program_name", "--batch-size", std::to_string(16 << (c % 6)),
+                  "--learning-rate", std::to_string(0.0001 * (c % 97 + 1)),
+                  "--layers", "1024,2048,4096,4096,2048",
+                  "-ll:gpus", c % 10 == 0 ? "eight" : std::to_string(1 + c % 8)};
+    for (const std::string & s : storage[c]) {
+      pointers[c].push_back(s.c_str());
+    }
+    candidates[c] = ArgvView{static_cast<int>(pointers[c].size()), pointers[c].data()};
+  }
+
+  std::cout << "batch: " << num_candidates << " candidates, " << std::thread::hardware_concurrency()
+            << " hardware threads" << std::endl;
+  double single_ms = 0;
+  for (unsigned threads : {1u, 2u, 4u, 8u, 16u, 32u, 64u}) {
+    double ms = bench_ns_per_op([&] {
+      bench_sink = parse_args_batch(args, candidates, threads).size();
+    }, 10) / 1e6;
+    if (threads == 1) {
+      single_ms = ms;
+    }
+    std::cout << "  " << threads << " threads  " << ms << " ms  x" << single_ms / ms << std::endl;
+  }
 }
 
-template <>
-float convert<float>(std::string const &s)  {
-  return std::stof(s);
+// rejecting bad candidates: parse_args has to throw and unwind, try_parse_args
+// hands back the error codes. A clean parse allocates the same either way.
+void bench_errors() {
+  ArgsParser args;
+  add_optional_argument(args, "--batch-size", std::optional<int>(32), "Size of each batch during training");
+  add_optional_argument(args, "--learning-rate", std::optional<float>(0.001), "Learning rate for the optimizer");
+  add_required_argument<int>(args, "-ll:gpus", std::nullopt, "Number of GPUs to be used for training");
+
+  const char *good_argv[] = {"program_name", "--batch-size", "64", "--learning-rate", "0.01", "-ll:gpus", "8"};
+  const char *bad_argv[] = {"program_name", "--batch-size", "sixty", "--learning-rate", "0.01", "-ll:gpus", "8"};
+  constexpr int test_argc = sizeof(good_argv) / sizeof(good_argv[0]);
+  constexpr int iters = 200000;
+
+  double throw_ns = bench_ns_per_op([&] {
+    try {
+      bench_sink = parse_args(args, test_argc, bad_argv).mValues.size();
+    } catch (const std::runtime_error &) {
+      bench_sink = 0;
+    }
+  }, iters);
+  double try_ns = bench_ns_per_op([&] {
+    bench_sink = try_parse_args(args, test_argc, bad_argv).errors.size();
+  }, iters);
+
+  std::size_t before = bench_allocations.load();
+  bench_sink = parse_args(args, test_argc, good_argv).mValues.size();
+  std::size_t throw_allocs = bench_allocations.load() - before;
+  before = bench_allocations.load();
+  bench_sink = try_parse_args(args, test_argc, good_argv).errors.size();
+  std::size_t try_allocs = bench_allocations.load() - before;
+
+  std::cout << "errors: 3 flags, one bad value" << std::endl;
+  std::cout << "  reject  parse_args + catch " << throw_ns << " ns  try_parse_args " << try_ns << " ns" << std::endl;
+  std::cout << "  allocations per clean parse  parse_args " << throw_allocs << "  try_parse_args " << try_allocs
+            << std::endl;
 }
 
-template <>
-bool convert<bool>(std::string const &s) {
-  return s == "true" || s == "1" || s == "yes";
+// the same candidates with and without five constraints on their values,
+// one of them a cross-field check
+void bench_constraints() {
+  auto make_schema = [](bool constrained) {
+    ArgsParser args;
+    auto batch_size = add_optional_argument(args, "--batch-size", std::optional<int>(32), "");
+    auto learning_rate = add_optional_argument(args, "--learning-rate", std::optional<float>(0.001f), "");
+    auto optimizer = add_optional_argument(args, "--optimizer", std::optional<std::string>("adam"), "");
+    auto run_name = add_optional_argument(args, "--run-name", std::optional<std::string>("run"), "");
+    auto warmup = add_optional_argument(args, "--warmup", std::optional<int>(0), "");
+    if (constrained) {
+      add_range(args, batch_size, 1, 65536);
+      add_range(args, learning_rate, 0, 1);
+      add_choices(args, optimizer, {"sgd", "adam", "adamw", "lamb"});
+      add_pattern(args, run_name, kAlnum | char_set("-_"), 1, 64);
+      add_check(args, "warmup must be below batch-size", [](int w, int b) { return w < b; }, warmup, batch_size);
+    }
+    return args;
+  };
+  ArgsParser plain = make_schema(false);
+  ArgsParser constrained = make_schema(true);
+
+  const char *test_argv[] = {"program_name", "--batch-size", "256", "--learning-rate", "0.01", "--optimizer", "adamw",
+                             "--run-name", "sweep-17_a", "--warmup", "16"};
+  constexpr int test_argc = sizeof(test_argv) / sizeof(test_argv[0]);
+  double plain_ns = bench_ns_per_op([&] {
+    bench_sink = try_parse_args(plain, test_argc, test_argv).errors.size();
+  }, 200000);
+  double constrained_ns = bench_ns_per_op([&] {
+    bench_sink = try_parse_args(constrained, test_argc, test_argv).errors.size();
+  }, 200000);
+
+  std::cout << "constraints: 5 flags, try_parse_args" << std::endl;
+  std::cout << "  unconstrained " << plain_ns << " ns  constrained " << constrained_ns << " ns" << std::endl;
 }
 
-ArgsParser parse_args(const ArgsParser & mArgs, int argc, const char **argv) {
-    int i  = 1;
-    ArgsParser result;
-    std::vector<std::string> required_args_passed;
-   for(const auto & [key, arg] : mArgs.mArguments) {
-    result.mArguments[key] = arg;
+// a sweep worker parsing 20000 candidates: every result on the global heap,
+// freed one by one, against all of them in one monotonic buffer released at
+// once, and against one small reused buffer per candidate
+void bench_arena() {
+  ArgsParser args;
+  add_optional_argument(args, "--batch-size", std::optional<int>(32), "Size of each batch during training");
+  add_optional_argument(args, "--learning-rate", std::optional<float>(0.001), "Learning rate for the optimizer");
+  add_optional_argument(args, "--weight-decay", std::optional<float>(0), "Weight decay");
+  add_optional_argument(args, "--optimizer", std::optional<std::string>("adam"), "Optimizer");
+  add_optional_argument(args, "--verbose", std::optional<bool>(false), "Verbose logs", true);
+  add_required_argument<int>(args, "-ll:gpus", std::nullopt, "Number of GPUs to be used for training");
+
+  constexpr std::size_t num_candidates = 20000;
+  std::vector<std::vector<std::string>> storage(num_candidates);
+  std::vector<std::vector<const char *>> pointers(num_candidates);
+  for (std::size_t c = 0; c < num_candidates; c++) {
+    storage[c] = {"program_name", "--batch-size", std::to_string(16 << (c % 6)), "--learning-rate",
+                  std::to_string(0.0001 * (c % 97 + 1)), "--weight-decay", "0.01", "--optimizer",
+                  c % 2 ? "sgd" : "adam", "--verbose", "-ll:gpus", std::to_string(1 + c % 8)};
+    for (const std::string & s : storage[c]) {
+      pointers[c].push_back(s.c_str());
+    }
   }
-  result.num_required_args = mArgs.num_required_args;
-  std::cout<<"parse_args, mArgs.num_required_args:"<<mArgs.num_required_args<<" and  result.num_required_args:"<<result.num_required_args<<std::endl;
+  auto argc_of = [&](std::size_t c) { return static_cast<int>(pointers[c].size()); };
 
-    while (i  < argc) {
-        std::string key = parseKey(argv[i]);
-        if (key == "help" || key == "h") {
-            exit(1);
-        }
+  std::vector<ArgsParser> results;
+  results.reserve(num_candidates);
+  std::size_t before = bench_allocations.load();
+  auto start = std::chrono::steady_clock::now();
+  for (std::size_t c = 0; c < num_candidates; c++) {
+    results.push_back(parse_args(args, argc_of(c), pointers[c].data()));
+  }
+  auto parsed = std::chrono::steady_clock::now();
+  results.clear();
+  auto stop = std::chrono::steady_clock::now();
+  std::size_t heap_allocs = bench_allocations.load() - before;
+  double heap_parse_ms = std::chrono::duration<double, std::milli>(parsed - start).count();
+  double heap_free_ms = std::chrono::duration<double, std::milli>(stop - parsed).count();
 
-        if(mArgs.mArguments.count(key) && mArgs.mArguments.at(key).is_store_true) {
-            result.mArguments[key].value = "true";
-            result.mArguments[key].is_store_true = true;
-            result.mArguments[key].is_store_passed = true;
-            i++;
-            continue; 
-        }
+  std::pmr::monotonic_buffer_resource arena(num_candidates * 1024);
+  before = bench_allocations.load();
+  start = std::chrono::steady_clock::now();
+  for (std::size_t c = 0; c < num_candidates; c++) {
+    results.push_back(parse_args(args, argc_of(c), pointers[c].data(), &arena));
+  }
+  parsed = std::chrono::steady_clock::now();
+  results.clear(); // only drops the schema references, the arena ignores the frees
+  arena.release();
+  stop = std::chrono::steady_clock::now();
+  std::size_t arena_allocs = bench_allocations.load() - before;
+  double arena_parse_ms = std::chrono::duration<double, std::milli>(parsed - start).count();
+  double arena_free_ms = std::chrono::duration<double, std::milli>(stop - parsed).count();
 
-        if (i + 1 < argc && argv[i + 1][0] != '-') {
-            if(result.mArguments.count(key)) {
-                if(result.mArguments.at(key).is_optional) {
-                  result.mArguments[key].value = argv[i + 1];
-                } else {
-                  //required args
-                  result.mArguments[key].value = argv[i + 1];
-                  result.pass_required_args++;
-                  required_args_passed.push_back(key);
-                }
-            }else {
-                throw std::runtime_error("invalid args: " + key + " does not exist") ;
-            }
-            i += 2; 
-        } else {
-            if (result.mArguments.count(key) && !result.mArguments.at(key).is_store_true) {
-                throw std::runtime_error("required args: " + key + " needs a value");
-            }
-            i++; 
-        }
+  // one stack buffer, reset after each candidate is read
+  alignas(std::max_align_t) char buffer[4096];
+  std::pmr::monotonic_buffer_resource worker(buffer, sizeof(buffer), std::pmr::null_memory_resource());
+  before = bench_allocations.load();
+  double reuse_ns = bench_ns_per_op([&] {
+    static std::size_t c = 0;
+    c = (c + 1) % num_candidates;
+    bench_sink = parse_args(args, argc_of(c), pointers[c].data(), &worker).mValues.size();
+    worker.release();
+  }, num_candidates);
+  std::size_t reuse_allocs = bench_allocations.load() - before;
+
+  std::cout << "arena: " << num_candidates << " candidates, 6 flags" << std::endl;
+  std::cout << "  global heap     parse " << heap_parse_ms << " ms  free " << heap_free_ms << " ms  "
+            << double(heap_allocs) / num_candidates << " allocations per parse" << std::endl;
+  std::cout << "  one arena       parse " << arena_parse_ms << " ms  free " << arena_free_ms << " ms  "
+            << double(arena_allocs) / num_candidates << " allocations per parse" << std::endl;
+  std::cout << "  reused buffer   " << reuse_ns << " ns per parse  "
+            << double(reuse_allocs) / (num_candidates * 11 / 10) << " allocations per parse" << std::endl;
+}
+
+struct BenchConfig {
+  int batch_size = 32;
+  float learning_rate = 0.001f;
+  int num_layers = 12;
+  bool verbose = false;
+  int gpus = 0;
+  int fsize = 1024;
+};
+ARGS_CONFIG(BenchConfig,
+            ARGS_OPTIONAL(batch_size, "--batch-size", "Size of each batch during training"),
+            ARGS_OPTIONAL(learning_rate, "--learning-rate", "Learning rate for the optimizer"),
+            ARGS_OPTIONAL(num_layers, "--num-layers", "Number of layers"),
+            ARGS_STORE_TRUE(verbose, "--verbose", "Whether to print verbose logs"),
+            ARGS_REQUIRED(gpus, "-ll:gpus", "Number of GPUs to be used for training"),
+            ARGS_OPTIONAL(fsize, "-ll:fsize", "Framebuffer memory per GPU in MB"));
+
+// refs and get() against a typed config struct, same flags, same argv, all
+// six values read 100 times per parse as a training loop would
+void bench_config() {
+  ArgsParser args;
+  auto batch_size_ref = add_optional_argument(args, "--batch-size", std::optional<int>(32), "");
+  auto learning_rate_ref = add_optional_argument(args, "--learning-rate", std::optional<float>(0.001f), "");
+  auto num_layers_ref = add_optional_argument(args, "--num-layers", std::optional<int>(12), "");
+  auto verbose_ref = add_optional_argument(args, "--verbose", std::optional<bool>(false), "", true);
+  auto gpus_ref = add_required_argument<int>(args, "-ll:gpus", std::nullopt, "");
+  auto fsize_ref = add_optional_argument(args, "-ll:fsize", std::optional<int>(1024), "");
+  const ConfigParser<BenchConfig> config_parser = make_config_parser<BenchConfig>();
+
+  const char *test_argv[] = {"program_name", "--batch-size", "100", "--learning-rate", "0.03",
+                             "-ll:gpus", "8", "-ll:fsize", "14000", "--verbose"};
+  constexpr int test_argc = sizeof(test_argv) / sizeof(test_argv[0]);
+  constexpr int reads = 100;
+
+  double get_ns = bench_ns_per_op([&] {
+    ArgsParser result = parse_args(args, test_argc, test_argv);
+    float acc = 0;
+    for (int r = 0; r < reads; r++) {
+      acc += get(result, batch_size_ref) + get(result, learning_rate_ref) + get(result, num_layers_ref) +
+             get(result, verbose_ref) + get(result, gpus_ref) + get(result, fsize_ref);
     }
-    std::cout<<"result.pass_required_args:"<<result.pass_required_args<<" and  result.pass_required_args:"<<result.pass_required_args<<std::endl;
-    if(result.num_required_args != result.pass_required_args) {
-        std::vector<std::string> missing_args;
-        for(const auto & [key, arg] : mArgs.mArguments) {
-            if(!arg.is_optional) {//required args
-                if(std::find(required_args_passed.begin(), required_args_passed.end(), key) == required_args_passed.end()) {
-                    missing_args.push_back(key);
-                }
-            }
-        }
-        //std::string missing_args_str = "";
-        for(const auto & arg : missing_args) {
-           // missing_args_str +=  arg + "  " ;
-            std::cout<<"missing_args:"<<arg<<std::endl;
-        }
-        throw std::runtime_error("some required args are not passed");
+    bench_sink = static_cast<std::size_t>(acc);
+  }, 20000);
+  double config_ns = bench_ns_per_op([&] {
+    BenchConfig config = parse_config(config_parser, test_argc, test_argv);
+    float acc = 0;
+    for (int r = 0; r < reads; r++) {
+      const volatile BenchConfig & c = config; // keep the loads in the loop
+      acc += c.batch_size + c.learning_rate + c.num_layers + c.verbose + c.gpus + c.fsize;
     }
+    bench_sink = static_cast<std::size_t>(acc);
+  }, 20000);
 
-    return result;
+  std::cout << "config: 6 flags, parse + " << reads << " reads of each" << std::endl;
+  std::cout << "  refs + get()    " << get_ns << " ns" << std::endl;
+  std::cout << "  typed config    " << config_ns << " ns" << std::endl;
+}
+
+// "did you mean" over 20000 generated keys: the bigram index with Myers
+// distances against a dynamic program over every key
+void bench_suggest() {
+  constexpr std::size_t num_keys = 20000;
+  ArgsParser args;
+  for (std::size_t k = 0; k < num_keys; k++) {
+    add_optional_argument(args, "--model-encoder-layer-" + std::to_string(k / 4) + "-param-" + std::to_string(k % 4),
+                          std::optional<int>(0), "");
   }
+  const ArgSchema & schema = *args.mSchema;
+  const std::vector<std::string> typos = {"model-encodr-layer-17-param-2", "model-encoder-layer-1234-parm-0",
+                                          "modle-encoder-layer-999-param-3", "model-encoder-lyer-4242-param-1"};
 
-template <typename T> 
-T get(const ArgsParser & parser , const CmdlineArgRef<T> &ref)  {
-    std::string key = ref.key;
-    if(parser.mArguments.count(key)) {
-      if(parser.mArguments.at(key).is_store_true) {
-        if(parser.mArguments.at(key).is_store_passed) {
-          return true;
-        } else {
-          return false;
-        }
+  auto start = std::chrono::steady_clock::now();
+  bench_sink = suggest_keys(schema, typos[0]).size(); // builds the index
+  double build_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  double index_us = bench_ns_per_op([&] {
+    for (const std::string & typo : typos) {
+      bench_sink = suggest_keys(schema, typo).size();
+    }
+  }, 200) / typos.size() / 1000;
+  double scan_us = bench_ns_per_op([&] {
+    for (const std::string & typo : typos) {
+      std::size_t best = typo.size();
+      for (std::size_t slot = 0; slot < num_keys; slot++) {
+        best = std::min(best, dp_distance(typo, arg_key(schema, slot)));
+      }
+      bench_sink = best;
+    }
+  }, 2) / typos.size() / 1000;
+
+  std::cout << "suggest: " << num_keys << " keys, top 3" << std::endl;
+  std::cout << "  index build      " << build_ms << " ms (once)" << std::endl;
+  std::cout << "  bigrams + Myers  " << index_us << " us/query" << std::endl;
+  std::cout << "  DP over all keys " << scan_us << " us/query" << std::endl;
+
+  // the same number of keys made of real words, which share bigrams the way
+  // real option names do
+  static const char *const words[] = {"learning", "rate", "batch", "size", "warmup", "steps", "weight", "decay",
+                                      "dropout", "hidden", "layers", "heads", "model", "encoder", "decoder",
+                                      "attention", "optimizer", "beta", "epsilon", "gradient", "clip", "norm", "seed",
+                                      "eval", "interval", "checkpoint", "dir", "log", "every", "max", "min", "num",
+                                      "workers", "prefetch", "shuffle", "buffer"};
+  constexpr std::size_t num_words = std::size(words);
+  ArgsParser varied;
+  std::vector<std::string> varied_keys;
+  for (std::size_t k = 0; k < num_keys; k++) {
+    std::size_t combo = k * 7919 % (num_words * num_words * num_words);
+    std::string key = std::string(words[combo % num_words]) + "-" + words[combo / num_words % num_words] + "-" +
+                      words[combo / num_words / num_words];
+    varied_keys.push_back(key);
+    add_optional_argument(varied, "--" + key, std::optional<int>(0), "");
+  }
+  std::vector<std::string> varied_typos;
+  for (std::size_t k : {17u, 1234u, 9999u, 15000u}) {
+    std::string typo = varied_keys[k];
+    std::swap(typo[3], typo[4]);
+    varied_typos.push_back(typo);
+  }
+  bench_sink = suggest_keys(*varied.mSchema, varied_typos[0]).size();
+  double varied_us = bench_ns_per_op([&] {
+    for (const std::string & typo : varied_typos) {
+      bench_sink = suggest_keys(*varied.mSchema, typo).size();
+    }
+  }, 2000) / varied_typos.size() / 1000;
+  std::cout << "  varied keys      " << varied_us << " us/query" << std::endl;
+
+  // a misspelled store_true switch has no value after it, the suggestion has
+  // to come all the same
+  ArgsParser switches;
+  add_optional_argument(switches, "--verbose", std::optional<bool>(false), "", true);
+  add_optional_argument(switches, "--dry-run", std::optional<bool>(false), "", true);
+  const char *typo_argv[] = {"program_name", "--verbsoe", "--dry-run"};
+  ParseOutcome outcome = try_parse_args(switches, 3, typo_argv);
+  std::cout << "  bare switch      " << (outcome.ok() ? "accepted" : error_message(outcome)) << std::endl;
+}
+
+// get() on a plain result against get() through a LiveConfig, whose read side
+// adds two atomic increments on a per-thread counter
+void bench_live() {
+  ArgsParser args;
+  auto lr_ref = add_optional_argument(args, "--learning-rate", std::optional<float>(0.001f), "");
+  const char *test_argv[] = {"program_name", "--learning-rate", "0.03"};
+  ArgsParser result = parse_args(args, 3, test_argv);
+  LiveConfig live(args, 3, test_argv);
+  constexpr int iters = 2000000;
+
+  double plain_ns = bench_ns_per_op([&] { bench_sink = static_cast<std::size_t>(get(result, lr_ref) * 100); }, iters);
+  double live_ns = bench_ns_per_op([&] { bench_sink = static_cast<std::size_t>(get(live, lr_ref) * 100); }, iters);
+  double reload_us = bench_ns_per_op([&] { bench_sink = live.reload(); }, 2000) / 1000;
+
+  std::cout << "live: get and reload" << std::endl;
+  std::cout << "  get(result)      " << plain_ns << " ns" << std::endl;
+  std::cout << "  get(live config) " << live_ns << " ns" << std::endl;
+  std::cout << "  reload           " << reload_us << " us" << std::endl;
+}
+
+// heap bytes and registration time per argument of a 20000 flag generated
+// schema: long keys, repeated help texts, int and string defaults
+void bench_memory() {
+  constexpr std::size_t num_keys = 20000;
+  const char *help[] = {"Hidden size of this transformer layer, see the model card for the valid range",
+                        "Number of attention heads of this transformer layer",
+                        "Dropout probability applied after the attention block of this layer",
+                        "Name of the activation function used by the feed forward block"};
+  std::vector<std::string> keys;
+  for (std::size_t k = 0; k < num_keys; k++) {
+    keys.push_back("--model-encoder-layer-" + std::to_string(k / 4) + (k % 4 == 3 ? "-activation" : "-param-" + std::to_string(k % 4)));
+  }
+
+  std::size_t before = bench_live_bytes.load();
+  auto start = std::chrono::steady_clock::now();
+  {
+    ArgsParser args;
+    for (std::size_t k = 0; k < num_keys; k++) {
+      if (k % 4 == 3) {
+        add_optional_argument(args, keys[k], std::optional<std::string>("gelu_approximate_tanh"), help[k % 4]);
       } else {
-        return convert<T>(parser.mArguments.at(key).value.value());
-        // if(parser.mArguments.at(key).is_optional) {
-        //   return convert<T>(parser.mArguments.at(key).value.value());
-        // } else {
-        //   return convert<T>(parser.mArguments.at(key).value.value());
-        // }
+        add_optional_argument(args, keys[k], std::optional<int>(static_cast<int>(k)), help[k % 4]);
+      }
+    }
+    double register_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    std::size_t bytes = bench_live_bytes.load() - before;
+    std::cout << "memory: " << num_keys << " generated flags" << std::endl;
+    std::cout << "  sizeof(Argument) " << sizeof(Argument) << " bytes" << std::endl;
+    std::cout << "  schema heap      " << bytes / num_keys << " bytes/argument" << std::endl;
+    std::cout << "  register         " << register_ns / num_keys << " ns/argument" << std::endl;
+  }
+}
+
+// the environment layer with one getenv per registered key, as parse_args did
+// before the environ scan, against for_each_env_entry
+void bench_env() {
+  constexpr std::size_t num_keys = 1000;
+  ArgsParser args;
+  set_env_prefix(args, "FF_");
+  for (std::size_t k = 0; k < num_keys; k++) {
+    add_optional_argument(args, "--flag-" + std::to_string(k), std::optional<int>(0), "");
+  }
+  for (std::size_t k = 0; k < num_keys; k += 50) {
+    setenv(("FF_FLAG_" + std::to_string(k)).c_str(), "1", 1);
+  }
+  const ArgSchema & schema = *args.mSchema;
+  std::size_t env_size = 0;
+  while (environ[env_size] != nullptr) {
+    env_size++;
+  }
+
+  double getenv_ns = bench_ns_per_op([&] {
+    std::size_t found = 0;
+    for (std::size_t slot = 0; slot < schema.mArguments.size(); slot++) {
+      found += std::getenv(env_name(*schema.mEnvPrefix, arg_key(schema, slot)).c_str()) != nullptr;
+    }
+    bench_sink = found;
+  }, 200);
+  double scan_ns = bench_ns_per_op([&] {
+    std::size_t found = 0;
+    for_each_env_entry(schema, [&](std::size_t, const char *) { found++; });
+    bench_sink = found;
+  }, 20000);
+
+  std::cout << "env: " << num_keys << " keys, " << env_size << " environment variables" << std::endl;
+  std::cout << "  getenv per key " << getenv_ns / 1000 << " us" << std::endl;
+  std::cout << "  environ scan   " << scan_ns / 1000 << " us" << std::endl;
+}
+
+// regression suite: parse_args throughput, get latency and allocations per
+// parse over schema sizes, argv lengths and flag kinds. Prints one JSON object
+// per configuration so runs can be diffed or loaded by a script.
+//   ./bench suite > suite.jsonl
+enum class FlagMix { StoreTrue, Optional, Required, Mixed };
+
+const char *flag_mix_name(FlagMix mix) {
+  switch (mix) {
+  case FlagMix::StoreTrue: return "store_true";
+  case FlagMix::Optional: return "optional";
+  case FlagMix::Required: return "required";
+  default: return "mixed";
+  }
+}
+
+// runs f for at least min_ms and returns ns per call
+template <typename F>
+double bench_ns_for(F && f, double min_ms) {
+  f();
+  int iters = 1;
+  while (true) {
+    double ns = bench_ns_per_op(f, iters);
+    if (ns * iters >= min_ms * 1e6 || iters >= (1 << 24)) {
+      return ns;
+    }
+    iters *= 4;
+  }
+}
+
+void bench_suite_case(std::size_t schema_size, std::size_t argv_flags, FlagMix mix) {
+  // the passed flags are spread over the schema, the rest stay optional ints
+  // so the schema size is the only thing that changes between rows
+  std::size_t stride = schema_size / argv_flags;
+  ArgsParser args;
+  std::vector<CmdlineArgRef<int>> int_refs;
+  std::vector<CmdlineArgRef<bool>> bool_refs;
+  std::vector<std::string> storage{"program_name"};
+  for (std::size_t k = 0; k < schema_size; k++) {
+    std::string key = "--flag-" + std::to_string(k);
+    bool in_argv = k % stride == 0 && k / stride < argv_flags;
+    FlagMix kind = mix != FlagMix::Mixed ? mix : static_cast<FlagMix>(k / stride % 3);
+    if (!in_argv) {
+      int_refs.push_back(add_optional_argument(args, key, std::optional<int>(0), "padding"));
+    } else if (kind == FlagMix::StoreTrue) {
+      bool_refs.push_back(add_optional_argument(args, key, std::optional<bool>(false), "switch", true));
+      storage.push_back(key);
+    } else if (kind == FlagMix::Required) {
+      int_refs.push_back(add_required_argument<int>(args, key, std::nullopt, "required"));
+      storage.insert(storage.end(), {key, std::to_string(k)});
+    } else {
+      int_refs.push_back(add_optional_argument(args, key, std::optional<int>(0), "optional"));
+      storage.insert(storage.end(), {key, std::to_string(k)});
+    }
+  }
+  std::vector<const char *> test_argv;
+  for (const std::string & arg : storage) {
+    test_argv.push_back(arg.c_str());
+  }
+  int test_argc = static_cast<int>(test_argv.size());
+
+  double parse_ns = bench_ns_for([&] {
+    bench_sink = parse_args(args, test_argc, test_argv.data()).mValues.size();
+  }, 50);
+
+  std::size_t before = bench_allocations.load();
+  ArgsParser result = parse_args(args, test_argc, test_argv.data());
+  std::size_t allocs = bench_allocations.load() - before;
+
+  // get over passed and defaulted keys alike, 64 lookups per call
+  std::vector<CmdlineArgRef<int>> lookups;
+  for (std::size_t n = 0; n < 64; n++) {
+    lookups.push_back(int_refs[n * 7919 % int_refs.size()]);
+  }
+  double get_ns = bench_ns_for([&] {
+    std::size_t acc = 0;
+    for (const CmdlineArgRef<int> & ref : lookups) {
+      acc += get(result, ref);
+    }
+    bench_sink = acc;
+  }, 20) / lookups.size();
+
+  std::cout << "{\"bench\":\"suite\",\"schema_size\":" << schema_size << ",\"argv_flags\":" << argv_flags
+            << ",\"argv_tokens\":" << (test_argc - 1) << ",\"mix\":\"" << flag_mix_name(mix)
+            << "\",\"parse_ns\":" << parse_ns << ",\"parses_per_s\":" << 1e9 / parse_ns
+            << ",\"get_ns\":" << get_ns << ",\"allocs_per_parse\":" << allocs << "}" << std::endl;
+}
+
+void bench_suite() {
+  for (std::size_t schema_size : {10u, 100u, 1000u, 10000u, 100000u}) {
+    for (std::size_t argv_flags : {1u, 8u, 64u}) {
+      if (argv_flags > schema_size) {
+        continue;
+      }
+      for (FlagMix mix : {FlagMix::StoreTrue, FlagMix::Optional, FlagMix::Required, FlagMix::Mixed}) {
+        bench_suite_case(schema_size, argv_flags, mix);
       }
     }
-    throw std::runtime_error("invalid args: " + ref.key);
+  }
+}
+
+int main(int argc, char **argv) {
+  std::string only = argc > 1 ? argv[1] : "";
+  if (only == "suite") {
+    // machine readable output only, not part of the default run
+    bench_suite();
+    return 0;
+  }
+  if (only.empty() || only == "static_schema") {
+    bench_static_schema();
+  }
+  if (only.empty() || only == "convert") {
+    bench_convert();
+  }
+  if (only.empty() || only == "list") {
+    bench_list();
+  }
+  if (only.empty() || only == "snapshot") {
+    bench_snapshot();
+  }
+  if (only.empty() || only == "batch") {
+    bench_batch();
+  }
+  if (only.empty() || only == "errors") {
+    bench_errors();
+  }
+  if (only.empty() || only == "constraints") {
+    bench_constraints();
+  }
+  if (only.empty() || only == "arena") {
+    bench_arena();
+  }
+  if (only.empty() || only == "env") {
+    bench_env();
+  }
+  if (only.empty() || only == "config") {
+    bench_config();
+  }
+  if (only.empty() || only == "memory") {
+    bench_memory();
+  }
+  if (only.empty() || only == "live") {
+    bench_live();
+  }
+  if (only.empty() || only == "suggest") {
+    bench_suggest();
+  }
+}
+
+#elif defined(TEST)
+// behaviour checks, build with
+//   g++ -std=c++17 -DTEST parse3.cc -o test -pthread && ./test [name]
+// prints every failed check and exits with 1 if there was one
+#include <sys/wait.h>
+
+static int test_failures = 0;
+
+#define TEST_CHECK(cond)                                                              \
+  do {                                                                                \
+    if (!(cond)) {                                                                    \
+      std::cout << "  FAILED line " << __LINE__ << ": " << #cond << std::endl;        \
+      test_failures++;                                                                \
+    }                                                                                 \
+  } while (0)
+
+// a fresh directory for the files of one check
+std::string test_dir() {
+  char dir[] = "/tmp/parse3-test-XXXXXX";
+  return mkdtemp(dir) != nullptr ? dir : "/tmp";
+}
+
+void write_file(const std::string & path, const std::string & text) {
+  // written next to path and renamed, like an editor would
+  std::string tmp = path + ".tmp";
+  FILE *f = std::fopen(tmp.c_str(), "w");
+  std::fputs(text.c_str(), f);
+  std::fclose(f);
+  std::rename(tmp.c_str(), path.c_str());
+}
+
+bool has_error(const ParseOutcome & outcome, ParseErrc code) {
+  return std::any_of(outcome.errors.begin(), outcome.errors.end(),
+                     [code](const ParseError & error) { return error.code == code; });
+}
+
+std::vector<std::string> pass_through(const ArgsParser & result) {
+  return std::vector<std::string>(result.mPassThrough.begin(), result.mPassThrough.end());
+}
+
+// a reload picks up the new file, a broken file keeps the last good result,
+// the command line still wins and watch() reloads on its own
+void test_live_reload() {
+  std::string config = test_dir() + "/train.cfg";
+  write_file(config, "epochs = 1\nbatch-size = 8\n");
+  ArgsParser args;
+  auto epochs = add_optional_argument(args, "--epochs", std::optional<int>(0), "");
+  auto batch_size = add_optional_argument(args, "--batch-size", std::optional<int>(0), "");
+  set_config_file(args, config);
+  const char *argv[] = {"program_name", "--batch-size", "32"};
+  LiveConfig live(args, 3, argv);
+  TEST_CHECK(get(live, epochs) == 1);
+  TEST_CHECK(get(live, batch_size) == 32);
+
+  write_file(config, "epochs = 2\nbatch-size = 8\n");
+  TEST_CHECK(live.reload());
+  TEST_CHECK(get(live, epochs) == 2);
+  TEST_CHECK(get(live, batch_size) == 32);
+  TEST_CHECK(live.generation() == 1);
+
+  write_file(config, "epochs = two\n");
+  TEST_CHECK(!live.reload());
+  TEST_CHECK(!live.last_error().empty());
+  TEST_CHECK(get(live, epochs) == 2);
+  TEST_CHECK(live.generation() == 1);
+
+  std::atomic<int> reloads{0};
+  live.watch([&](bool ok, const std::string &) { reloads += ok; });
+  write_file(config, "epochs = 3\n");
+  for (int ms = 0; ms < 2000 && reloads == 0; ms++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  TEST_CHECK(reloads > 0);
+  TEST_CHECK(get(live, epochs) == 3);
+}
+
+// 8 ranks of one node parse the same argv, all of them see the values and
+// the last one to map the segment removes it
+void test_shared_ranks() {
+  constexpr int kRanks = 8;
+  ArgsParser args;
+  auto epochs = add_optional_argument(args, "--epochs", std::optional<int>(0), "");
+  auto model = add_optional_argument(args, "--model", std::optional<std::string>("none"), "");
+  const char *argv[] = {"program_name", "--epochs", "7", "--model", "resnet"};
+  std::string name = "parse3-test-" + std::to_string(getpid());
+  for (int rank = 0; rank < kRanks; rank++) {
+    if (fork() == 0) {
+      ArgsParser result = parse_args_shared(args, 5, argv, name, kRanks);
+      _exit(get(result, epochs) == 7 && get(result, model) == "resnet" ? 0 : 1);
+    }
+  }
+  int failed_ranks = 0;
+  for (int rank = 0; rank < kRanks; rank++) {
+    int status = 0;
+    wait(&status);
+    failed_ranks += !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+  }
+  TEST_CHECK(failed_ranks == 0);
+  std::string segment = shared_segment_name(name, snapshot_key(args, 5, argv));
+  int fd = shm_open(segment.c_str(), O_RDONLY, 0);
+  TEST_CHECK(fd < 0 && errno == ENOENT);
+  if (fd >= 0) {
+    close(fd);
+    shm_unlink(segment.c_str());
+  }
+}
+
+// response files that include each other fail instead of recursing, also
+// when the snapshot key hashes them
+void test_response_file_cycle() {
+  std::string dir = test_dir();
+  write_file(dir + "/a.rsp", "--epochs 3 @" + dir + "/b.rsp\n");
+  write_file(dir + "/b.rsp", "@" + dir + "/a.rsp\n");
+  write_file(dir + "/self.rsp", "--epochs 4 @" + dir + "/self.rsp\n");
+  write_file(dir + "/leaf.rsp", "--epochs 5\n");
+  write_file(dir + "/twice.rsp", "@" + dir + "/leaf.rsp @" + dir + "/leaf.rsp\n");
+  ArgsParser args;
+  auto epochs = add_optional_argument(args, "--epochs", std::optional<int>(0), "");
+
+  for (const char *file : {"a.rsp", "self.rsp"}) {
+    std::string token = "@" + dir + "/" + file;
+    const char *argv[] = {"program_name", token.c_str()};
+    ParseOutcome outcome = try_parse_args(args, 2, argv);
+    TEST_CHECK(has_error(outcome, ParseErrc::ResponseFileCycle));
+    TEST_CHECK(error_message(outcome).find("include cycle") != std::string::npos);
+    snapshot_key(args, 2, argv); // has to return
+  }
+
+  // the message names every file of the cycle, innermost first
+  std::string a_token = "@" + dir + "/a.rsp";
+  const char *a_argv[] = {"program_name", a_token.c_str()};
+  TEST_CHECK(error_message(try_parse_args(args, 2, a_argv)) ==
+             "response file: include cycle at " + dir + "/a.rsp\n"
+             "  included from " + dir + "/b.rsp\n"
+             "  included from " + dir + "/a.rsp");
+
+  // the same file twice side by side is not a cycle
+  std::string token = "@" + dir + "/twice.rsp";
+  const char *argv[] = {"program_name", token.c_str()};
+  ParseOutcome outcome = try_parse_args(args, 2, argv);
+  TEST_CHECK(outcome.ok());
+  TEST_CHECK(outcome.ok() && get(outcome.result, epochs) == 5);
+}
+
+// command line over environment over config file over default
+void test_layer_precedence() {
+  std::string config = test_dir() + "/layers.cfg";
+  write_file(config, "from-config = 2\nfrom-env = 2\nfrom-cli = 2\n");
+  ArgsParser args;
+  auto from_default = add_optional_argument(args, "--from-default", std::optional<int>(1), "");
+  auto from_config = add_optional_argument(args, "--from-config", std::optional<int>(1), "");
+  auto from_env = add_optional_argument(args, "--from-env", std::optional<int>(1), "");
+  auto from_cli = add_optional_argument(args, "--from-cli", std::optional<int>(1), "");
+  set_config_file(args, config);
+  set_env_prefix(args, "PARSE3_TEST_");
+  setenv("PARSE3_TEST_FROM_ENV", "3", 1);
+  setenv("PARSE3_TEST_FROM_CLI", "3", 1);
+  const char *argv[] = {"program_name", "--from-cli", "4"};
+  ArgsParser result = parse_args(args, 3, argv);
+  unsetenv("PARSE3_TEST_FROM_ENV");
+  unsetenv("PARSE3_TEST_FROM_CLI");
+
+  TEST_CHECK(get(result, from_default) == 1);
+  TEST_CHECK(get(result, from_config) == 2);
+  TEST_CHECK(get(result, from_env) == 3);
+  TEST_CHECK(get(result, from_cli) == 4);
+  TEST_CHECK(get_source(result, from_default) == ValueSource::Default);
+  TEST_CHECK(get_source(result, from_config) == ValueSource::ConfigFile);
+  TEST_CHECK(get_source(result, from_env) == ValueSource::Environment);
+  TEST_CHECK(get_source(result, from_cli) == ValueSource::CommandLine);
+}
+
+// a cached snapshot is not used once a response file, the config file or
+// the environment it was taken from changed
+void test_snapshot_staleness() {
+  std::string dir = test_dir();
+  std::string snapshot = dir + "/args.snap";
+  write_file(dir + "/run.rsp", "--epochs 1\n");
+  write_file(dir + "/run.cfg", "batch-size = 8\n");
+  ArgsParser args;
+  auto epochs = add_optional_argument(args, "--epochs", std::optional<int>(0), "");
+  auto batch_size = add_optional_argument(args, "--batch-size", std::optional<int>(0), "");
+  auto seed = add_optional_argument(args, "--seed", std::optional<int>(0), "");
+  set_config_file(args, dir + "/run.cfg");
+  set_env_prefix(args, "PARSE3_TEST_");
+  std::string token = "@" + dir + "/run.rsp";
+  const char *argv[] = {"program_name", token.c_str()};
+
+  ArgsParser first = parse_args_cached(args, 2, argv, snapshot);
+  TEST_CHECK(get(first, epochs) == 1 && get(first, batch_size) == 8 && get(first, seed) == 0);
+  ArgsParser cached = parse_args_cached(args, 2, argv, snapshot);
+  TEST_CHECK(get(cached, epochs) == 1 && get(cached, batch_size) == 8);
+
+  write_file(dir + "/run.rsp", "--epochs 2\n");
+  TEST_CHECK(get(parse_args_cached(args, 2, argv, snapshot), epochs) == 2);
+  write_file(dir + "/run.cfg", "batch-size = 16\n");
+  TEST_CHECK(get(parse_args_cached(args, 2, argv, snapshot), batch_size) == 16);
+  setenv("PARSE3_TEST_SEED", "42", 1);
+  TEST_CHECK(get(parse_args_cached(args, 2, argv, snapshot), seed) == 42);
+  unsetenv("PARSE3_TEST_SEED");
+  TEST_CHECK(get(parse_args_cached(args, 2, argv, snapshot), seed) == 0);
+}
+
+// flags of a namespace the schema does not know are kept in order for the
+// runtime that owns it, a registered handler gets them instead
+void test_namespace_pass_through() {
+  ArgsParser args;
+  auto epochs = add_optional_argument(args, "--epochs", std::optional<int>(0), "");
+  auto gpus = add_optional_argument(args, "-ll:gpus", std::optional<int>(1), "");
+  const char *argv[] = {"program_name", "-ll:gpus", "4", "--epochs", "2", "-lg:prof", "-lg:level", "3"};
+  ArgsParser result = parse_args(args, 8, argv);
+  TEST_CHECK(get(result, epochs) == 2);
+  TEST_CHECK(get(result, gpus) == 4);
+  TEST_CHECK((pass_through(result) == std::vector<std::string>{"-lg:prof", "-lg:level", "3"}));
+  // -ll: is known through -ll:gpus, so a misspelled flag of it is an error
+  const char *misspelled[] = {"program_name", "-ll:cpus", "4"};
+  ParseOutcome outcome = try_parse_args(args, 3, misspelled);
+  TEST_CHECK(has_error(outcome, ParseErrc::UnknownKey));
+  TEST_CHECK(outcome.result.mPassThrough.empty());
+
+  ArgsParser plain;
+  add_optional_argument(plain, "--epochs", std::optional<int>(0), "");
+  const char *foreign[] = {"program_name", "-ll:gpus", "4", "--epochs", "2", "-lg:prof", "-ll:csize", "512"};
+  ArgsParser kept = parse_args(plain, 8, foreign);
+  TEST_CHECK((pass_through(kept) == std::vector<std::string>{"-ll:gpus", "4", "-lg:prof", "-ll:csize", "512"}));
+
+  std::vector<std::string> handled;
+  add_namespace_handler(plain, "ll", [&](std::string_view key, std::string_view value) {
+    handled.push_back(std::string(key) + "=" + std::string(value));
+  });
+  ArgsParser with_handler = parse_args(plain, 8, foreign);
+  TEST_CHECK((handled == std::vector<std::string>{"-ll:gpus=4", "-ll:csize=512"}));
+  TEST_CHECK((pass_through(with_handler) == std::vector<std::string>{"-lg:prof"}));
+}
+
+// parse_known_args keeps unknown flags and everything from "--" on, "--"
+// included, and does not read registered keys after it
+void test_known_args_dashdash() {
+  ArgsParser args;
+  auto epochs = add_optional_argument(args, "--epochs", std::optional<int>(0), "");
+  const char *argv[] = {"program_name", "--epochs", "2", "--unknown", "x", "--", "--epochs", "3", "input.txt"};
+  ArgsParser result = parse_known_args(args, 9, argv);
+  TEST_CHECK(get(result, epochs) == 2);
+  TEST_CHECK((pass_through(result) ==
+              std::vector<std::string>{"--unknown", "x", "--", "--epochs", "3", "input.txt"}));
+
+  // a prefix of a registered key is not taken as an abbreviation here
+  const char *prefix[] = {"program_name", "--ep", "5"};
+  ArgsParser unabbreviated = parse_known_args(args, 3, prefix);
+  TEST_CHECK(get(unabbreviated, epochs) == 0);
+  TEST_CHECK((pass_through(unabbreviated) == std::vector<std::string>{"--ep", "5"}));
+}
+
+int main(int argc, char **argv) {
+  std::string only = argc > 1 ? argv[1] : "";
+  const std::pair<const char *, void (*)()> tests[] = {
+      {"live_reload", test_live_reload},
+      {"shared_ranks", test_shared_ranks},
+      {"response_file_cycle", test_response_file_cycle},
+      {"layer_precedence", test_layer_precedence},
+      {"snapshot_staleness", test_snapshot_staleness},
+      {"namespace_pass_through", test_namespace_pass_through},
+      {"known_args_dashdash", test_known_args_dashdash},
+  };
+  for (const auto & [name, test] : tests) {
+    if (only.empty() || only == name) {
+      int before = test_failures;
+      test();
+      std::cout << (test_failures == before ? "ok      " : "FAILED  ") << name << std::endl;
+    }
+  }
+  return test_failures == 0 ? 0 : 1;
 }
 
+#else
+
 /** normal test
 int main() {
 
@@ -329,7 +4626,7 @@ int main() {
 //     std::cout<<"learning_rate:"<<get(result, learning_rate_ref)<<std::endl;
 //     std::cout<<"ll_gpus:"<<get(result, ll_gpus_ref)<<std::endl;
 //     std::cout<<"verbose:"<<get(result, verbose_ref)<<std::endl;*/
-//     CmdlineArgRef<int> invalid_ref{"invalid", {}};
+//     CmdlineArgRef<int> invalid_ref{42};
 //     char const *test_argv[] = {"program_name"};
 
 //     ArgsParser args;
@@ -435,17 +4732,17 @@ int main() {
         "0.03",
     };
     ArgsParser args;
-    auto batch_size_ref =
+    [[maybe_unused]] auto batch_size_ref =
         add_optional_argument(args,
                               "--batch-size",
                               std::optional<int>(32),
                               "Size of each batch during training");
-    auto learning_rate_ref =
+    [[maybe_unused]] auto learning_rate_ref =
         add_optional_argument(args,
                               "--learning-rate",
                               std::optional<float>(0.001),
                               "Learning rate for the optimizer");
-    auto epoch_ref = add_optional_argument(args,
+    [[maybe_unused]] auto epoch_ref = add_optional_argument(args,
                                            "--epoch",
                                            std::optional<int>(1),
                                            "Number of epochs for training");
@@ -453,4 +4750,6 @@ int main() {
         sizeof(test_argv) / sizeof(test_argv[0]);
     parse_args(
         args, test_argv_length, const_cast<char const **>(test_argv));
-}
\ No newline at end of file
+}
+
+#endif